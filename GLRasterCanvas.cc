@@ -30,6 +30,7 @@
 #include "GLRasterCanvas.h"
 
 #include <algorithm>
+#include "hf-simd.h"
 
 static char rcsid[] = "$Id: GLRasterCanvas.cc,v 1.1.2.10 2004/09/24 17:18:23 zvrba Exp $";
 
@@ -520,6 +521,27 @@ static void minmax(
 	}
 }
 
+// float pixels in rect coordinates are the common case (hfield); use the
+// SIMD kernel and skip the second scan for real images (re == im)
+template<>
+void minmax<float, rect>(
+	rect,
+	const void *re_, const void *im_, unsigned int n,
+	float *min, float *max)
+{
+	const float *re = static_cast<const float*>(re_);
+	const float *im = static_cast<const float*>(im_);
+
+	min[0] = max[0] = re[0];
+	v_minmax(re, n, &min[0], &max[0]);
+	if(im == re) {
+		min[1] = min[0]; max[1] = max[0];
+	} else {
+		min[1] = max[1] = im[0];
+		v_minmax(im, n, &min[1], &max[1]);
+	}
+}
+
 template<typename CoordXform>
 static void minmax(
 	int pixtype, const void *re_, const void *im_, unsigned int n,
@@ -0,0 +1,279 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Gaussian blurs, done separably: a pass along the rows into a scratch
+ * image, then one down the columns. gaussblur convolves with the
+ * sampled kernel out to gaufac sigmas, with SIMD span kernels; its cost
+ * grows with sigma. iirblur runs the third order recursive filter of
+ * Young and van Vliet forwards and backwards over each line instead,
+ * which costs the same per pixel for any sigma.
+ *
+ * Off the edges lines wrap if the image tiles; otherwise the edge
+ * pixels repeat.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-simd.h"
+#include "hf-tile.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define IIR_STRIP	16			/* lines filtered side by side */
+
+/* FIR pass along each row of a into out; w[0..r] are the kernel taps */
+struct fir_rows : public hf_rows {
+	const PTYPE *a;
+	PTYPE *out;
+	const PTYPE *w;
+	int xsize, r, wrap;
+
+	fir_rows(const PTYPE *a_, PTYPE *o, const PTYPE *w_, int x, int r_, int wr) :
+		a(a_), out(o), w(w_), xsize(x), r(r_), wrap(wr) { }
+	void run(U y0, U y1) {
+		PTYPE *in;
+		U y;
+		int i, k;
+
+		if (!(in = (PTYPE*)malloc((xsize + 2*r) * sizeof(PTYPE)))) {
+			fprintf(stderr, "ERROR: gaussblur: out of memory.\n");
+			return;
+		}
+		for (y = y0; y < y1; y++) {
+			PTYPE *o = &El(out,0,y);
+
+			for (i = -r; i < xsize + r; i++)
+				in[i+r] = El(a,h_edge(i, xsize, wrap),y);
+			memset(o, 0, xsize * sizeof(PTYPE));
+			v_madd2(in + r, in + r, o, xsize, 0.5f * w[0]);
+			for (k = 1; k <= r; k++)
+				v_madd2(in + r-k, in + r+k, o, xsize, w[k]);
+		}
+		free(in);
+	}
+};
+
+/* FIR pass down the columns: each output row is a weighted sum of rows */
+struct fir_cols : public hf_rows {
+	const PTYPE *a;
+	PTYPE *out;
+	const PTYPE *w;
+	int xsize, ysize, r, wrap;
+
+	fir_cols(const PTYPE *a_, PTYPE *o, const PTYPE *w_, int x, int y, int r_, int wr) :
+		a(a_), out(o), w(w_), xsize(x), ysize(y), r(r_), wrap(wr) { }
+	void run(U y0, U y1) {
+		U y;
+		int k;
+
+		for (y = y0; y < y1; y++) {
+			PTYPE *o = &El(out,0,y);
+
+			memset(o, 0, xsize * sizeof(PTYPE));
+			v_madd2(&El(a,0,y), &El(a,0,y), o, xsize, 0.5f * w[0]);
+			for (k = 1; k <= r; k++)
+				v_madd2(&El(a,0,h_edge((int)y-k, ysize, wrap)),
+						&El(a,0,h_edge((int)y+k, ysize, wrap)), o, xsize, w[k]);
+		}
+	}
+};
+
+/*
+  Recursive filter over strips of IIR_STRIP lines. Lines run along the
+  rows (cols FALSE) or down the columns of a; each is padded by pad
+  pixels at either end so that the filter has settled by the time it
+  reaches the image.
+*/
+struct iir_lines : public hf_rows {
+	const PTYPE *a;
+	PTYPE *out;
+	int xsize, ysize, pad, wrap, cols;
+	D B, b1, b2, b3;
+
+	iir_lines(const PTYPE *a_, PTYPE *o, int x, int y, int p, int wr, int c,
+			  const D *b) :
+		a(a_), out(o), xsize(x), ysize(y), pad(p), wrap(wr), cols(c),
+		B(b[0]), b1(b[1]), b2(b[2]), b3(b[3]) { }
+	void run(U s0, U s1) {
+		int n = cols ? ysize : xsize;	/* line length */
+		int nl = cols ? xsize : ysize;	/* number of lines */
+		int m = n + 2*pad, i, l, l0, nw;
+		D *b;
+		U s;
+
+		/* b[i*IIR_STRIP + l]: pixel i of line l0+l */
+		if (!(b = (D*)malloc((size_t)m * IIR_STRIP * sizeof(D)))) {
+			fprintf(stderr, "ERROR: iirblur: out of memory.\n");
+			return;
+		}
+		for (s = s0; s < s1; s++) {
+			l0 = s * IIR_STRIP;
+			nw = MIN(IIR_STRIP, nl - l0);
+			for (i = 0; i < m; i++) {
+				D *r = b + i*IIR_STRIP;
+				int e = h_edge(i - pad, n, wrap);
+
+				for (l = 0; l < nw; l++)
+					r[l] = cols ? El(a,l0+l,e) : El(a,e,l0+l);
+			}
+			/* forward; clamping the indices starts it in the steady state
+			   of the first pixel, since B + b1 + b2 + b3 = 1 */
+			for (i = 0; i < m; i++) {
+				D *r = b + i*IIR_STRIP;
+				const D *r1 = b + MAX(i-1, 0)*IIR_STRIP;
+				const D *r2 = b + MAX(i-2, 0)*IIR_STRIP;
+				const D *r3 = b + MAX(i-3, 0)*IIR_STRIP;
+
+				for (l = 0; l < nw; l++)
+					r[l] = B*r[l] + b1*r1[l] + b2*r2[l] + b3*r3[l];
+			}
+			/* and backward, from the steady state of the last */
+			for (i = m-1; i >= 0; i--) {
+				D *r = b + i*IIR_STRIP;
+				const D *r1 = b + MIN(i+1, m-1)*IIR_STRIP;
+				const D *r2 = b + MIN(i+2, m-1)*IIR_STRIP;
+				const D *r3 = b + MIN(i+3, m-1)*IIR_STRIP;
+
+				for (l = 0; l < nw; l++)
+					r[l] = B*r[l] + b1*r1[l] + b2*r2[l] + b3*r3[l];
+			}
+			for (i = 0; i < n; i++) {
+				const D *r = b + (i+pad)*IIR_STRIP;
+
+				for (l = 0; l < nw; l++) {
+					if (cols) El(out,l0+l,i) = r[l];
+					else El(out,i,l0+l) = r[l];
+				}
+			}
+		}
+		free(b);
+	}
+};
+
+/* new HF with the real part of h0 blurred: rows of h0 into tmp, then
+   columns of tmp into the result */
+static hfield *blur_new(hfield *h0, PTYPE **tmp, const char *name)
+{
+	hfield *h1;
+
+	if(h0->c) fprintf(stderr, "WARNING: %s: blurring real part only.\n", name);
+	/* imag. part stays zero */
+	if(!(h1 = h_new(h0->xsize, h0->ysize, h0->c, h0->c))) return NULL;
+	if(!(*tmp = h_alloc((size_t)h0->xsize * h0->ysize, FALSE))) {
+		h_delete(h1);
+		return NULL;
+	}
+	return h1;
+}
+
+/*
+  Gaussian blur with standard deviation sigma pixels, by direct
+  convolution with the kernel truncated at gaufac*sigma.
+*/
+hfield *h_gaussblur(hfield *h0, D sigma)
+{
+	hfield *h1;
+	PTYPE *tmp, *w;
+	int xsize, ysize, wrap, r, k;
+	D sum;
+
+	h_sync(h0);
+
+	if(sigma <= 0) {
+		fprintf(stderr, "ERROR: gaussblur: sigma must be > 0.\n");
+		return NULL;
+	}
+	xsize = h0->xsize;
+	ysize = h0->ysize;
+	wrap = h_tilable(h0, 0);
+	r = MAX((int)ceil(HF_PARAMS.gaufac * sigma), 1);
+
+	if(!(w = (PTYPE*)malloc((r+1) * sizeof(PTYPE)))) {
+		fprintf(stderr, "ERROR: gaussblur: out of memory.\n");
+		return NULL;
+	}
+	for(sum = 0, k = 0; k <= r; k++)
+		sum += (k ? 2 : 1) * exp(-k*k / (2*sigma*sigma));
+	for(k = 0; k <= r; k++)
+		w[k] = exp(-k*k / (2*sigma*sigma)) / sum;
+
+	if(!(h1 = blur_new(h0, &tmp, "gaussblur"))) {
+		free(w);
+		return NULL;
+	}
+	fir_rows fr(h0->a, tmp, w, xsize, r, wrap);
+	h_parfor(fr, ysize, (U)xsize * r);
+	fir_cols fc(tmp, h1->a, w, xsize, ysize, r, wrap);
+	h_parfor(fc, ysize, (U)xsize * r);
+
+	h_free(tmp);
+	free(w);
+	h_dirty(h1);
+	return h1;
+}
+
+/*
+  Gaussian blur approximated by the recursive filter of Young and van
+  Vliet (1995). The work per pixel doesn't depend on sigma; for sigma
+  below 0.5, where the approximation fails, gaussblur is used.
+*/
+hfield *h_iirblur(hfield *h0, D sigma)
+{
+	hfield *h1;
+	PTYPE *tmp;
+	int xsize, ysize, wrap, pad;
+	D q, q2, q3, b0, b[4];
+
+	h_sync(h0);
+
+	if(sigma < 0.5)
+		return h_gaussblur(h0, sigma);
+	xsize = h0->xsize;
+	ysize = h0->ysize;
+	wrap = h_tilable(h0, 0);
+	pad = (int)ceil(HF_PARAMS.gaufac * sigma);
+
+	if(sigma >= 2.5) q = 0.98711*sigma - 0.96330;
+	else q = 3.97156 - 4.14554*sqrt(1 - 0.26891*sigma);
+	q2 = q*q;
+	q3 = q2*q;
+	b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+	b[1] = (2.44413*q + 2.85619*q2 + 1.26661*q3) / b0;
+	b[2] = -(1.4281*q2 + 1.26661*q3) / b0;
+	b[3] = 0.422205*q3 / b0;
+	b[0] = 1 - (b[1] + b[2] + b[3]);
+
+	if(!(h1 = blur_new(h0, &tmp, "iirblur"))) return NULL;
+	iir_lines ir(h0->a, tmp, xsize, ysize, pad, wrap, FALSE, b);
+	h_parfor(ir, (ysize + IIR_STRIP-1) / IIR_STRIP, (U)IIR_STRIP * xsize);
+	iir_lines ic(tmp, h1->a, xsize, ysize, pad, wrap, TRUE, b);
+	h_parfor(ic, (xsize + IIR_STRIP-1) / IIR_STRIP, (U)IIR_STRIP * ysize);
+
+	h_free(tmp);
+	h_dirty(h1);
+	return h1;
+}
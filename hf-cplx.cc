@@ -4,6 +4,8 @@
 #include <string.h>
 #include <memory.h>
 #include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-tile.h"
 
 static char rcsid[] UNUSED = "$Id: hf-cplx.cc,v 1.1.2.2 2003/12/31 15:25:18 zvrba Exp $";
 
@@ -16,11 +18,14 @@ hfield *c_swap(hfield *hfin) /* swap complex and real parts of matrix */
 	hfield *chf;
 	D tmp;
 
+	h_sync(hfin);
+
 	hf = hfin->a;
 	xsize = hfin->xsize;
 	ysize = hfin->ysize;
 
 	if (hfin->c) {              /* swap real, imag parts of mx */
+		h_own(hfin);
 		for (ix=0;ix<xsize;ix++) {
 			for (iy=0;iy<ysize;iy++) {
 				tmp = El(hf,ix,iy);
@@ -39,42 +44,91 @@ hfield *c_swap(hfield *hfin) /* swap complex and real parts of matrix */
 		}
 	}  /* end if cflag */
 
-	h_minmax(chf); /* new real extrema */
+	h_dirty(chf);
 	return chf;
 }
 
+struct cmag_rows : public hf_rows {
+	const PTYPE *hfc;
+	PTYPE *hfr;
+	int xsize, ysize;			/* for Im() */
+
+	cmag_rows(const PTYPE *c, PTYPE *r, int x, int y) :
+		hfc(c), hfr(r), xsize(x), ysize(y) { }
+	void run(U y0, U y1) {
+		int ix,iy;
+
+		for (iy=y0;iy<(int)y1;iy++) {
+			for (ix=0;ix<xsize;ix++) {
+				El(hfr,ix,iy) =
+					sqrt(pow(El(hfc,ix,iy),2)+pow(Im(hfc,ix,iy),2));
+			}
+		}
+	}
+};
+
 hfield *c_mag(hfield *hfc)		/* take magnitude of complex matrix */
 {
-	int ix,iy;
 	int xsize, ysize;
 	hfield *hfr;
 
+	h_sync(hfc);
+
 	if(!hfc->c) {
 		fprintf(stderr, "ERROR: cmag: matrix not complex.\n");
 		return NULL;
 	}
 	xsize = hfc->xsize;
 	ysize = hfc->ysize;
-	if(!(hfr = h_newr(xsize,ysize))) return NULL;
+	if(!(hfr = h_new(xsize,ysize,FALSE,FALSE))) return NULL;
 
 	/* compute magnitude of matrix */
+	cmag_rows cm(hfc->a, hfr->a, xsize, ysize);
+	h_parfor(cm, ysize, xsize);
 
-	for (ix=0;ix<xsize;ix++) {
-		for (iy=0;iy<ysize;iy++) {
-			El(hfr->a,ix,iy) =
-				sqrt(pow(El(hfc->a,ix,iy),2)+pow(Im(hfc->a,ix,iy),2));
-		}
-	}
-
-	h_minmax(hfr);
+	h_dirty(hfr);
 	return hfr;
 }
 
+struct cconvert_rows : public hf_rows {
+	PTYPE *hf;
+	int xsize, ysize;
+	int dir;
+
+	cconvert_rows(PTYPE *a, int x, int y, int d) :
+		hf(a), xsize(x), ysize(y), dir(d) { }
+	void run(U y0, U y1) {
+		int ix,iy;
+		D re, im;        /* temporary variables */
+
+		if (dir==0) {           /* rectangular -> polar */
+			for (iy=y0;iy<(int)y1;iy++) {
+				for (ix=0;ix<xsize;ix++) {
+					re = El(hf,ix,iy);
+					im = Im(hf,ix,iy);
+					El(hf,ix,iy) = sqrt(re*re + im*im);
+					Im(hf,ix,iy) = ATAN2(im,re);
+				}
+			}
+		} else {                /* polar -> rectangular */
+			for (iy=y0;iy<(int)y1;iy++) {
+				for (ix=0;ix<xsize;ix++) {
+					re = El(hf,ix,iy);
+					im = Im(hf,ix,iy);
+					El(hf,ix,iy) = re * cos(im);
+					Im(hf,ix,iy) = re * sin(im);
+				}
+			}
+		}
+	}
+};
+
 hfield *c_convert(hfield *hfc, int dir)	/* convert complex matrix Rect <-> Polar */
 {
-	int ix,iy;
 	int xsize, ysize;
-	D re, im;        /* temporary variables */
+
+	h_sync(hfc);
+	h_own(hfc);
 
 	if(!hfc->c) {
 		fprintf(stderr, "ERROR: convert: matrix not complex.\n");
@@ -84,27 +138,10 @@ hfield *c_convert(hfield *hfc, int dir)	/* convert complex matrix Rect <-> Polar
 	ysize = hfc->ysize;
 
 	/* convert matrix */
-	if (dir==0) {           /* rectangular -> polar */
-		for (ix=0;ix<xsize;ix++) {
-			for (iy=0;iy<ysize;iy++) {
-				re = El(hfc->a,ix,iy);
-				im = Im(hfc->a,ix,iy);
-				El(hfc->a,ix,iy) = sqrt(re*re + im*im);
-				Im(hfc->a,ix,iy) = ATAN2(im,re);
-			}
-		}
-	} else {                /* polar -> rectangular */
-		for (ix=0;ix<xsize;ix++) {
-			for (iy=0;iy<ysize;iy++) {
-				re = El(hfc->a,ix,iy);
-				im = Im(hfc->a,ix,iy);
-				El(hfc->a,ix,iy) = re * cos(im);
-				Im(hfc->a,ix,iy) = re * sin(im);
-			}
-		}
-	}
+	cconvert_rows cc(hfc->a, xsize, ysize, dir);
+	h_parfor(cc, ysize, xsize);
 
-	h_minmax(hfc); /* new real extrema */
+	h_dirty(hfc);
 	return hfc;
 }
 
@@ -114,6 +151,9 @@ hfield *c_join(hfield *hfr, hfield *hfi) /* make complex from real & imag parts
 	unsigned int ix, iy, xsize, ysize;
 	hfield *hfc;
 
+	h_sync(hfr);
+	h_sync(hfi);
+
 	xsize = hfr->xsize;
 	ysize = hfr->ysize;
 	if(xsize != hfi->xsize || ysize != hfi->ysize) {
@@ -121,7 +161,7 @@ hfield *c_join(hfield *hfr, hfield *hfi) /* make complex from real & imag parts
 		return NULL;
 	}
 
-	if(!(hfc = h_newc(xsize,ysize))) return NULL;
+	if(!(hfc = h_new(xsize,ysize,TRUE,FALSE))) return NULL;
 
 	for (ix=0;ix<xsize;ix++) {   /* old real part -> new imag. part */
 		for (iy=0;iy<ysize;iy++) {
@@ -130,7 +170,7 @@ hfield *c_join(hfield *hfr, hfield *hfi) /* make complex from real & imag parts
 		}
 	}
   
-	h_minmax(hfc);				/* new real extrema */
+	h_dirty(hfc);
 	return hfc;
 }
 
@@ -140,6 +180,8 @@ int c_split(hfield *hfc, hfield **hfr, hfield **hfi)  /* divide complex into rea
 	int ix,iy;
 	int xsize, ysize;
 
+	h_sync(hfc);
+
 	if(hfc->c) {
 		fprintf(stderr, "ERROR: csplit: matrix not complex.\n");
 		return 0;
@@ -147,8 +189,8 @@ int c_split(hfield *hfc, hfield **hfr, hfield **hfi)  /* divide complex into rea
 
 	xsize = hfc->xsize;
 	ysize = hfc->ysize;
-	if(!(*hfr = h_newr(xsize,ysize))) return 0;
-	if(!(*hfi = h_newr(xsize,ysize))) return 0;
+	if(!(*hfr = h_new(xsize,ysize,FALSE,FALSE))) return 0;
+	if(!(*hfi = h_new(xsize,ysize,FALSE,FALSE))) return 0;
 
 	for (ix=0;ix<xsize;ix++) { 
 		for (iy=0;iy<ysize;iy++) {
@@ -157,8 +199,8 @@ int c_split(hfield *hfc, hfield **hfr, hfield **hfi)  /* divide complex into rea
 		}
 	}
 
-	h_minmax(*hfr);
-	h_minmax(*hfi);
+	h_dirty(*hfr);
+	h_dirty(*hfi);
 	return 1;
 }
 
@@ -166,68 +208,159 @@ hfield *c_real(hfield *hf)  /* take real part of array */
 {
 	int xsize, ysize;
 	size_t memsize;
+	PTYPE *a;
+
+	h_sync(hf);
 
 	if(!hf->c) return hf;    /* nothing to do */
 
 	xsize = hf->xsize;
 	ysize = hf->ysize;
   
-	memsize = (size_t)xsize*ysize*sizeof(PTYPE);
-	if(!(hf->a = (float*)realloc(hf->a, memsize))) { /* truncate array to real */
-		fprintf(stderr, "FATAL: c_real: realloc shrinking returned NULL\n");
-		exit(1);
-	}
+	if(h_shared(hf->a)) {		/* copy just the real part */
+		memsize = (size_t)xsize*ysize*sizeof(PTYPE);
+		if(!(a = h_alloc((size_t)xsize*ysize, FALSE))) {
+			fprintf(stderr, "FATAL: c_real: out of memory\n");
+			exit(1);
+		}
+		memcpy(a, hf->a, memsize);
+		h_free(hf->a);
+		hf->a = a;
+	} else						/* truncate array to real */
+		hf->a = h_shrink(hf->a, (size_t)xsize*ysize);
 	hf->c = FALSE;
+	hf->rxsize = 0;
 	return hf;
 }
 
-hfield *c_diff(hfield *hf) /* make complex from x & y slope of matrix */
+/*
+  Expand the half spectrum hfh (see h_newh) into a full complex matrix,
+  filling in the missing columns as F(x,y) = conj F(-x,-y).
+*/
+hfield *c_expand(hfield *hfh)
 {
 	int ix,iy;
+	int xsize, ysize, xsize2, ysize2;
+	hfield *hfc;
+
+	h_sync(hfh);
+
+	if(!hfh->c || !hfh->rxsize) {
+		fprintf(stderr, "ERROR: cexpand: matrix is not a half spectrum.\n");
+		return NULL;
+	}
+	xsize2 = hfh->xsize;
+	ysize2 = hfh->ysize;
+	xsize = hfh->rxsize;
+	ysize = ysize2;
+	if(!(hfc = h_new(xsize,ysize,TRUE,FALSE))) return NULL;
+
+	for (iy=0;iy<ysize;iy++) {
+		for (ix=0;ix<xsize2;ix++) {
+			El(hfc->a,ix,iy) = El2(hfh->a,ix,iy);
+			Im(hfc->a,ix,iy) = Im2(hfh->a,ix,iy);
+		}
+		for (;ix<xsize;ix++) {
+			El(hfc->a,ix,iy) = El2(hfh->a,xsize-ix,(ysize-iy)%ysize);
+			Im(hfc->a,ix,iy) = -Im2(hfh->a,xsize-ix,(ysize-iy)%ysize);
+		}
+	}
+
+	h_dirty(hfc);
+	return hfc;
+}
+
+struct cdiff_tiles : public hf_tiles {
+	PTYPE *hfc;
+	int xsize, ysize;			/* for El/Im */
+
+	cdiff_tiles(PTYPE *a, int x, int y) : hfc(a), xsize(x), ysize(y) { }
+	void run(hf_tile &t) {
+		int ix,iy;
+		D xdiff, ydiff, tmp;
+
+		for (iy=0;iy<t.h;iy++) {
+			for (ix=0;ix<t.w;ix++) {
+				tmp = Tl(t,ix,iy);
+				xdiff = tmp-Tl(t,ix-1,iy);
+				ydiff = tmp-Tl(t,ix,iy-1);
+				El(hfc,t.x0+ix,t.y0+iy) = xdiff;
+				Im(hfc,t.x0+ix,t.y0+iy) = ydiff;
+			}
+		}
+	}
+};
+
+hfield *c_diff(hfield *hf) /* make complex from x & y slope of matrix */
+{
 	int xsize, ysize;
 	hfield *hfc;
 	int tile;
-	D xdiff, ydiff, tmp;
+
+	h_sync(hf);
 
 	xsize = hf->xsize;
 	ysize = hf->ysize;
 	tile = h_tilable(hf, 0);
 
-	if(!(hfc = h_newc(xsize,ysize))) return NULL;
+	if(!(hfc = h_new(xsize,ysize,TRUE,FALSE))) return NULL;
 
-	for (ix=0;ix<xsize;ix++) {   /* old real part -> new imag. part */
-		for (iy=0;iy<ysize;iy++) {
-			tmp = El(hf->a,ix,iy);
-			if (tile) {
-				xdiff = tmp-Elmod(hf->a,ix-1,iy);
-				ydiff = tmp-Elmod(hf->a,ix,iy-1);
-			} else {
-				xdiff = tmp-Elclip(hf->a,ix-1,iy);
-				ydiff = tmp-Elclip(hf->a,ix,iy-1);
-			}
-			El(hfc->a,ix,iy) = xdiff;
-			Im(hfc->a,ix,iy) = ydiff;
-		}
-	}
+	/* old real part -> new imag. part */
+	cdiff_tiles ct(hfc->a, xsize, ysize);
+	h_partiles(ct, hf->a, xsize, ysize, 1, tile);
   
-	h_minmax(hfc); /* new real extrema */
+	h_dirty(hfc);
 	return hfc;
 }
 
-hfield *c_int(hfield *hf0) /* generate real mx from complex x&y diff'l */
+/*
+  c_int(hf, method) -- real matrix from the x & y differentials in the
+                       real & imag. parts of hf, as c_diff makes them.
+     method = "path"     the original recurrence, averaging the paths
+                         from the left and from above
+              "poisson"  least squares fit to all of the differentials
+*/
+hfield *c_int(hfield *hf0, const char *method) /* generate real mx from complex x&y diff'l */
 {
 	int xsize,ysize;
 	int ix,iy;
+	int wrap;
 	hfield *hf1;
 
+	h_sync(hf0);
+
 	if(!hf0->c) {
 		fprintf(stderr, "ERROR: cint: input must be complex.\n");
 		return NULL;
 	}
 	xsize = hf0->xsize;
 	ysize = hf0->ysize;
+	if(strcmp(method, "path") && strcmp(method, "poisson")) {
+		fprintf(stderr, "ERROR: cint: %s: unknown method.\n", method);
+		return NULL;
+	}
 	if(!(hf1 = h_newr(xsize,ysize))) return NULL;
 
+	if(!strcmp(method, "poisson")) {
+		/* c_diff leaves column 0 of x and row 0 of y zero unless it
+		   wrapped around the edges */
+		if (HF_PARAMS.tile_mode == TON) wrap = TRUE;
+		else if (HF_PARAMS.tile_mode == TOFF) wrap = FALSE;
+		else {
+			wrap = FALSE;
+			for (iy=0;iy<ysize && !wrap;iy++)
+				wrap = El(hf0->a,0,iy) != 0;
+			for (ix=0;ix<xsize && !wrap;ix++)
+				wrap = Im(hf0->a,ix,0) != 0;
+		}
+		if(!p_integrate(hf1->a, hf0->a, &Im(hf0->a,0,0), xsize, ysize, wrap)) {
+			h_delete(hf1);
+			return NULL;
+		}
+		h_dirty(hf1);
+		return hf1;
+	}
+
 	El(hf1->a,0,0) = 0;        /* start with corner [0,0] = 0.0 */
 	for (ix=1;ix<xsize;ix++)
 		El(hf1->a,ix,0) = El(hf1->a,ix-1,0) + El(hf0->a,ix,0);
@@ -241,6 +374,6 @@ hfield *c_int(hfield *hf0) /* generate real mx from complex x&y diff'l */
 		}
 	}
 
-	h_minmax(hf1);				/* find min,max values */
+	h_dirty(hf1);
 	return hf1;
 }
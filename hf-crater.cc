@@ -22,7 +22,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-sat.h"
 
 static char rcsid[] UNUSED = "$Id: hf-crater.cc,v 1.1.2.3 2003/12/31 15:25:18 zvrba Exp $";
 
@@ -84,21 +87,177 @@ static double dissolve(double nsq_rad)
 }
 
 #define CRATER_COVERAGE 0.15
+#define SQUEEZE 1.3
+
+/* one crater; all are generated before any is made, so that they can
+   be sorted and spread over the threads */
+struct crater {
+	int xloc, yloc;				/* centre */
+	int cratersize;				/* radius in pixels */
+	double craterscale;			/* vertical crater scaling factor */
+	unsigned n;					/* order of generation */
+};
+
+static int crater_cmp(const void *p1, const void *p2) /* biggest first */
+{
+	const crater *c1 = (const crater*)p1, *c2 = (const crater*)p2;
+
+	if (c1->cratersize != c2->cratersize)
+		return c2->cratersize - c1->cratersize;
+	return c1->n < c2->n ? -1 : c1->n > c2->n;
+}
+
+/* add crater cr to real; imag is the crater-free underground and
+   with, pure are summed-area tables of real and imag */
+static void make_crater(const crater *cr, PTYPE *real, const PTYPE *imag,
+						int xsize, int ysize, int wrap,
+						const hf_sat *with, const hf_sat *pure)
+{
+	int i, j, ii, jj, h;
+	int xloc = cr->xloc, yloc = cr->yloc, cratersize = cr->cratersize;
+	int sq_radius;
+	double nsq_rad, weight, shift;
+	double level_with, level_pure;
+	double craterscale = cr->craterscale;
+
+	/* what is the mean height of this plot: over the square of the
+	   same area as the crater */
+	h = (int)(cratersize * 0.886);
+	level_with = sat_mean(with, xloc-h, yloc-h, xloc+h+1, yloc+h+1, wrap);
+	level_pure = sat_mean(pure, xloc-h, yloc-h, xloc+h+1, yloc+h+1, wrap);
+
+	/* Now lets create the crater. */
+
+
+	/* In order to do it efficiently, we calculate for one octant
+	 * only and use eightfold symmetry, if possible.
+	 * Main diagonals and axes have a four fold symmetry only.
+	 * The center point has to be treated single.
+	 */
+
+/* this macro calculates the coordinates, does clipping and modifies
+ * the elevation at this spot due to shift and weight.
+ * Imag() contains the crater-free underground. Real() contains the result.
+ * level_with: average altitude of cratered surface in region
+ * level_pure: average altitude of uncratered surface
+ */
+
+#define SHIFT(x,y) { \
+    ii = xloc + (x); jj = yloc + (y); \
+    if (wrap || ((ii >= 0) && (ii < xsize) && \
+		 (jj >= 0) && (jj < ysize))) {\
+      X_WRAP(ii);  Y_WRAP(jj); \
+      El(real,ii,jj) = (shift  + (El(real,ii,jj))*weight + \
+      (level_with + (El(imag,ii,jj)-level_pure)/SQUEEZE) * (1.0-weight)); \
+    } \
+  }
+
+/* macro to do four points at once. Points are rotated by 90 degrees. */
+#define FOURFOLD(i,j)   SHIFT(i,j) SHIFT(-j,i) SHIFT(-i,-j) SHIFT(j,-i)
+
+/* get eightfold symmetry by mirroring fourfold symmetry along the x==y axe */
+#define EIGHTFOLD       FOURFOLD(i,j) FOURFOLD(j,i)
 
-/*  DISTRIBUTE_CRATERS  --  doing some damage to the surface */
 
+	/* The loop covers a triangle (except the center point)
+	 * Eg cratersize is 3, coordinates are shown as i,j
+	 *
+	 *              3,3 j
+	 *         2,2  3,2 |
+	 *    1,1  2,1  3,1 v
+	 * x  1,0  2,0  3,0
+	 * ^          <-i
+	 * |
+	 * center point
+	 *
+	 * 2,1 , 3,2 and 3,1 have eightfold symmetry.
+	 * 1,0 , 2,0 , 3,0 , 1,1 , 2,2 and 3,3 have fourfold symmetry.
+	 */
+
+	for (i = cratersize; i > 0; i--) {
+		for (j = i; j >= 0; j--) {
+
+			/* check if outside */
+			sq_radius = i*i+j*j;
+			nsq_rad = (double)sq_radius/cratersize/cratersize;
+			if (nsq_rad > 1) continue;
+
+			/* inside the crater area */
+			shift = craterscale*crater_profile(nsq_rad);
+			weight = dissolve(nsq_rad);
+
+			if (i==j || j==0) {
+				FOURFOLD(i,j)
+			} else {
+				EIGHTFOLD
+			}
+		}
+	}
+	/* the center point */
+	shift =  craterscale*crater_profile(0.0);
+	weight = dissolve(0.0);
+	SHIFT(0,0)
+}
+
+/* craters of the tiles tile[t0..t1); those of tile k are
+   cr[first[k]..first[k+1]) */
+struct crater_tiles : public hf_rows {
+	const crater *cr;
+	const int *first, *tile;
+	PTYPE *real;
+	const PTYPE *imag;
+	int xsize, ysize, wrap;
+	const hf_sat *with, *pure;
+
+	crater_tiles(const crater *c, const int *f, const int *t, PTYPE *r,
+				 const PTYPE *i, int x, int y, int w, const hf_sat *sw,
+				 const hf_sat *sp) :
+		cr(c), first(f), tile(t), real(r), imag(i), xsize(x), ysize(y),
+		wrap(w), with(sw), pure(sp) { }
+	void run(U t0, U t1) {
+		U t;
+		int i;
+
+		for (t = t0; t < t1; t++)
+			for (i = first[tile[t]]; i < first[tile[t]+1]; i++)
+				make_crater(&cr[i], real, imag, xsize, ysize, wrap, with, pure);
+	}
+};
+
+/* tiles along an axis n pixels long for craters of radius up to r: at
+   least 2r wide, and an even number of them if they wrap around */
+static int crater_ntiles(int n, int r, int wrap)
+{
+	int nt = n / (2*r);
+
+	if (nt < 1) nt = 1;
+	if (wrap && nt > 1 && (nt & 1)) nt--;
+	return nt;
+}
+
+/*  DISTRIBUTE_CRATERS  --  doing some damage to the surface */
+/*
+  The craters are all generated first and sorted by size, greatest
+  first, so great craters never eliminate small ones. They are then
+  made in levels of craters between half and the full size of the
+  first one. Within a level, each crater goes to the tile its centre
+  is in; tiles are at least as wide as a crater, so craters of tiles
+  two apart can't overlap, and the four sets of tiles with even or odd
+  row and column are each done in parallel. The mean height around a
+  crater comes from summed-area tables of the terrain as it was
+  before the level and before any craters.
+*/
 int distribute_craters(PTYPE *real, PTYPE *imag, int xsize, int ysize, 
 					   unsigned int how_many, int wrap, D ch_scale, D cr_scale, D b1)
 {
-    int i, j, k, xloc, yloc, cratersize;
-    int sq_radius;
-    double nsq_rad, weight;
-    int lev_samples, samples;
-    double level_with, level_pure;
-    double craterscale;                 /* vertical crater scaling factor */
-    double c,d2, shift;
+    int k, s, e, i, cratersize;
+    int ntx, nty, nt, color, ncol;
+    double c,d2;
     double b2,b3;                       /* radius scaling params */
     int meshsize;                       /* mean of xsize and ysize ? */
+    crater *cr, *sorted;
+    int *first, *tile;
+    hf_sat with = SAT_INIT, pure = SAT_INIT;
 
     /* init constants */
     
@@ -113,142 +272,83 @@ int distribute_craters(PTYPE *real, PTYPE *imag, int xsize, int ysize,
     d = a1 - cos(alpha);
 
     /* build a copy of the terrain */
-    for (i = 0 ; i < xsize; i++)
-		for (j = 0 ; j < ysize; j++)
-			El(imag,i,j) = El(real,i,j);
-
-    k = how_many;
-    while (k > 0) {
-		int ii, jj;
+    memcpy(imag, real, (size_t)xsize*ysize*sizeof(PTYPE));
+    if (!how_many)
+		return(0);
+
+    cr = (crater*)malloc(how_many * sizeof(crater));
+    sorted = (crater*)malloc(how_many * sizeof(crater));
+    if (!cr || !sorted || !sat_build(&pure, imag, xsize, ysize)) {
+		fprintf(stderr, "ERROR: crater: out of memory.\n");
+		free(cr); free(sorted); sat_free(&pure);
+		return(1);
+    }
 
+    for (k = 0; k < (int)how_many; k++) {
 		/* pick a cratersize according to a power law distribution */
-		/* greatest first. So great craters never eliminate small ones */
-		/* c = (double)(how_many-k+1)/how_many + b3; */
-		/* craters appear in random order */
-
 		c = ran1() + b3;       /* c is in the range b3 ... b3+1 */
 		d2 = b2/c/c/c/c;       /* d2 is in the range 0 ... 1 */
 
 		if (how_many == 1) d2 = 1.0;   /* single craters set to max. size */
 
-		xloc = (int)(ran1() * xsize); /* pick a random location for the crater */
-		yloc = (int)(ran1() * ysize);
+		cr[k].xloc = (int)(ran1() * xsize); /* pick a random location for the crater */
+		cr[k].yloc = (int)(ran1() * ysize);
+		cr[k].n = k;
 
 		cratersize = 3 + (int)(d2 * CRATER_COVERAGE * meshsize * cr_scale);
-
+		cr[k].cratersize = cratersize;
 
 /* macro to determine the height dependent on crater size */
 #define CRATER_SCALE (((ch_scale*pow((cratersize/(3+CRATER_COVERAGE*meshsize)),0.9)) \
 		       /256*pow(meshsize/256.0,0.1))/CRATER_COVERAGE*80)
 
-		craterscale = CRATER_SCALE;     /* vertical crater scaling factor */
-	
-		/* what is the mean height of this plot */
-		samples = lev_samples = MAX((cratersize*cratersize)/5, 1);
-		level_with = level_pure = 0.0;
-		while (samples) {
-			/* */
-			/*  i = rand()%(2*cratersize+1) - cratersize;
-				j = rand()%(2*cratersize+1) - cratersize; */
-			i = (int)(ran1()*(2*cratersize) - cratersize);
-			j = (int)(ran1()*(2*cratersize) - cratersize);
-
-			if (i*i+j*j > cratersize*cratersize) continue;
-			ii = xloc + i; jj = yloc + j;
-
-			/* handle wrapping details... */
-
-			if ((wrap) || 
-				((ii >= 0) && (ii < xsize) && (jj >= 0) && (jj < ysize))) {
-				X_WRAP(ii);
-				Y_WRAP(jj);
-				level_with += El(real, ii, jj);
-				level_pure += El(imag, ii, jj);
-				samples--;
-			}
-
+		cr[k].craterscale = CRATER_SCALE;     /* vertical crater scaling factor */
+    }
+    qsort(cr, how_many, sizeof(crater), crater_cmp);
+
+    for (s = 0; s < (int)how_many; s = e) {
+		for (e = s; e < (int)how_many && 2*cr[e].cratersize > cr[s].cratersize; e++)
+			;
+		ntx = crater_ntiles(xsize, cr[s].cratersize, wrap);
+		nty = crater_ntiles(ysize, cr[s].cratersize, wrap);
+		nt = ntx * nty;
+		first = (int*)calloc(nt+1, sizeof(int));
+		tile = (int*)malloc(nt * sizeof(int));
+		if (!first || !tile || !sat_build(&with, real, xsize, ysize)) {
+			fprintf(stderr, "ERROR: crater: out of memory.\n");
+			free(first); free(tile);
+			break;
 		}
-		level_with /= lev_samples;
-		level_pure /= lev_samples;
 
-		/* Now lets create the crater. */
-
-
-		/* In order to do it efficiently, we calculate for one octant
-		 * only and use eightfold symmetry, if possible.
-		 * Main diagonals and axes have a four fold symmetry only.
-		 * The center point has to be treated single.
-		 */
-
-#define SQUEEZE 1.3
-
-/* this macro calculates the coordinates, does clipping and modifies
- * the elevation at this spot due to shift and weight.
- * Imag() contains the crater-free underground. Real() contains the result.
- * level_with: average altitude of cratered surface in region
- * level_pure: average altitude of uncratered surface
- */
-
-#define SHIFT(x,y) { \
-    ii = xloc + (x); jj = yloc + (y); \
-    if (wrap || ((ii >= 0) && (ii < xsize) && \
-		 (jj >= 0) && (jj < ysize))) {\
-      X_WRAP(ii);  Y_WRAP(jj); \
-      El(real,ii,jj) = (shift  + (El(real,ii,jj))*weight + \
-      (level_with + (El(imag,ii,jj)-level_pure)/SQUEEZE) * (1.0-weight)); \
-    } \
-  }
-
-/* macro to do four points at once. Points are rotated by 90 degrees. */
-#define FOURFOLD(i,j)   SHIFT(i,j) SHIFT(-j,i) SHIFT(-i,-j) SHIFT(j,-i)
-
-/* get eightfold symmetry by mirroring fourfold symmetry along the x==y axe */
-#define EIGHTFOLD       FOURFOLD(i,j) FOURFOLD(j,i)
-
-
-		/* The loop covers a triangle (except the center point)
-		 * Eg cratersize is 3, coordinates are shown as i,j
-		 *
-		 *              3,3 j
-		 *         2,2  3,2 |
-		 *    1,1  2,1  3,1 v
-		 * x  1,0  2,0  3,0
-		 * ^          <-i
-		 * |
-		 * center point
-		 *
-		 * 2,1 , 3,2 and 3,1 have eightfold symmetry.
-		 * 1,0 , 2,0 , 3,0 , 1,1 , 2,2 and 3,3 have fourfold symmetry.
-		 */
-
-		for (i = cratersize; i > 0; i--) {
-			for (j = i; j >= 0; j--) {
-
-				/* check if outside */
-				sq_radius = i*i+j*j;
-				nsq_rad = (double)sq_radius/cratersize/cratersize;
-				if (nsq_rad > 1) continue;
-
-				/* inside the crater area */
-				shift = craterscale*crater_profile(nsq_rad);
-				weight = dissolve(nsq_rad);
-
-				if (i==j || j==0) {
-					FOURFOLD(i,j)
-						} else {
-							EIGHTFOLD
-								}
-			}
+		/* sort the level by tile, keeping the order within a tile */
+#define CRATER_TILE(p) ((int)((long)(p)->yloc*nty/ysize)*ntx + (int)((long)(p)->xloc*ntx/xsize))
+		for (i = s; i < e; i++)
+			first[CRATER_TILE(&cr[i]) + 1]++;
+		for (i = 0; i < nt; i++)
+			first[i+1] += first[i];
+		for (i = s; i < e; i++)
+			sorted[s + first[CRATER_TILE(&cr[i])]++] = cr[i];
+		for (i = nt; i > 0; i--)
+			first[i] = s + first[i-1];
+		first[0] = s;
+
+		for (color = 0; color < 4; color++) {
+			ncol = 0;
+			for (i = 0; i < nt; i++)
+				if (((i / ntx) & 1) == (color >> 1) && ((i % ntx) & 1) == (color & 1)
+					&& first[i+1] > first[i])
+					tile[ncol++] = i;
+			crater_tiles ct(sorted, first, tile, real, imag, xsize, ysize, wrap,
+							&with, &pure);
+			h_parfor(ct, ncol, (U)(xsize/ntx) * (ysize/nty));
 		}
-		/* the center point */
-		shift =  craterscale*crater_profile(0.0);
-		weight = dissolve(0.0);
-		SHIFT(0,0)
-
-			/* one crater added */
-			k--;
-		/* printf("%d craters of %d created\n", how_many - k, how_many); */
+		free(first);
+		free(tile);
     }
-	return(0);
-} /* end distribute_craters() */
 
+    sat_free(&with);
+    sat_free(&pure);
+    free(sorted);
+    free(cr);
+    return(0);
+} /* end distribute_craters() */
@@ -4,7 +4,10 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 #include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-tile.h"
 
 static char rcsid[] UNUSED = "$Id: hf-erode.cc,v 1.1.2.2 2003/12/31 15:25:18 zvrba Exp $";
 
@@ -23,198 +26,108 @@ static int yo[9] = { 0,-1,-1,-1,0,1,1, 1, 0 };
 /* lowestn()    --      returns direction of steepest descent from */
 /*                      element x,y in hf1[] array                 */
 /* ------------------------------------------------------------ */
-static int lowestn(hfield *hf, int x, int y, D *r, int tile)
+static int lowestn(hf_tile &t, int x, int y, D *r)
 { 
-	PTYPE *hf1;
-	int xsize, ysize;
 	int i, mini;
 	float here, slope, min;
 
-	hf1 = hf->a;
-	xsize = hf->xsize;
-	ysize = hf->ysize;
 	mini = 0;  
 	min = FLT_MAX;
-	here = El(hf1,x,y);
-	if (tile) {
-		for (i=1;i<9;i++) {
-			slope = Elmod(hf1,x+xo[i],y+yo[i]) - here;
-			if ( (i==1) || (i==3) || (i==5) || (i==7) )
-				slope = slope / 1.414;
-			if (slope < min) {
-				mini = i;
-				min = slope;
-			}
+	here = Tl(t,x,y);
+	for (i=1;i<9;i++) {
+		slope = Tl(t,x+xo[i],y+yo[i]) - here;
+		if ( (i==1) || (i==3) || (i==5) || (i==7) )
+			slope = slope / 1.414;
+		if (slope < min) {
+			mini = i;
+			min = slope;
 		}
-	} else {  /* tile == FALSE */
-		for (i=1;i<9;i++) {
-			slope = Elclip(hf1,x+xo[i],y+yo[i]) - here;
-			if ( (i==1) || (i==3) || (i==5) || (i==7) )
-				slope = slope / 1.414;
-			if (slope < min) {
-				mini = i;
-				min = slope;
-			}
-		}
-	} /* end if(tile) */
+	}
 	*r = min;
 	return mini;
 }
 
-static int is_lowest(hfield *hf, int x, int y, int tile) /* 1 if x,y is min */
+/* fl[] <- lowestn() for every element; 0 if no neighbour is lower */
+struct flow_tiles : public hf_tiles {
+	BYTE *fl;
+	int xsize;					/* for El */
+
+	flow_tiles(BYTE *f, int x) : fl(f), xsize(x) { }
+	void run(hf_tile &t) {
+		int ix, iy, dir;
+		D slope;
+
+		for (iy = 0; iy < t.h; iy++)
+			for (ix = 0; ix < t.w; ix++) {
+				dir = lowestn(t,ix,iy,&slope);
+				El(fl,t.x0+ix,t.y0+iy) = slope < 0 ? dir : 0;
+			}
+	}
+};
+
+static int is_lowest(const PTYPE *p, const int *off) /* 1 if *p is min */
 {
-	int i;
-	int xsize, ysize;
+	int i, low;
 	PTYPE here;
-	D diff;
 
-	xsize = hf->xsize;
-	ysize = hf->ysize;
-	if (tile) {
-		here = Elmod(hf->a,x,y);
-		for (i=1;i<9;i++) {
-			diff = Elmod(hf->a,x+xo[i],y+yo[i]) - here;
-			if (diff < 0) return(FALSE);
-		}
-		return(TRUE);
-	} else {
-		here = Elclip(hf->a,x,y);
-		for (i=1;i<9;i++) {
-			diff = Elclip(hf->a,x+xo[i],y+yo[i]) - here;
-			if (diff < 0) return(FALSE);
-		}
-	} /* end else (not h_tilable) */
-	return(TRUE);
+	/* no early exit: on rough terrain it is mispredicted half the time */
+	here = *p;
+	low = TRUE;
+	for (i=1;i<9;i++)
+		low &= !(p[off[i]] < here);
+	return(low);
 } /* is_lowest */
 
-/* ------------------------------------------------------------ */
-/*  fill_bn  --  fill in basins in heightfield area             */
-/*               input is hf1, output is in hf2                 */
-/* ------------------------------------------------------------ */
-static int fill_bn(hfield *h2, hfield *h1)
-{
-	PTYPE *hf1, *hf2;
-	int xsize, ysize;
-	int count;              /* number of minima changed */
-	int tile;
-	int ix,iy,i;
-	float sum, neb, wavg;
+struct fill_tiles : public hf_tiles {
+	PTYPE *hf2;
+	int xsize;					/* for El */
+	int count;					/* number of minima changed */
 
-	hf1 = h1->a;              /* array part of heightfield 1 */
-	hf2 = h2->a;
-	xsize = h1->xsize;
-	ysize = h1->ysize;
-	tile = h_tilable(h1, 0);  /* 1 if tilable, 0 if not */
-	count = 0;
-  
-	/* start with exact copy */
-	/*
-	  for (iy=0;iy<ysize;iy++) {       
-	  for (ix=0;ix<xsize;ix++) {
-	  El(hf2,ix,iy) = El(hf1,ix,iy);
-	  }
-	  }
-	*/
-
-	for(iy=0;iy<ysize;iy++)  {
-		for (ix=0;ix<xsize;ix++)  {
-			if (is_lowest(h1,ix,iy,tile))  {           /* local depression */
-				count++;
-				sum = 0; 
-				if (tile) {
-					for (i=1;i<9;i++) {
-						neb = Elmod(hf1,ix+xo[i],iy+yo[i]);      /* neighbor elev. */
-						sum += neb;                   /* get sum of neighbor elevs */
-					}
-				} else {
+	fill_tiles(PTYPE *a2, int x) : hf2(a2), xsize(x), count(0) { }
+	void run(hf_tile &t) {
+		int ix,iy,i;
+		int n = 0;
+		int off[9];				/* xo,yo as offsets within the tile */
+		const PTYPE *p;
+		float sum, neb, wavg;
+
+		for (i=0;i<9;i++)
+			off[i] = yo[i]*t.ld + xo[i];
+		for(iy=0;iy<t.h;iy++)  {
+			for (ix=0;ix<t.w;ix++)  {
+				p = &Tl(t,ix,iy);
+				if (is_lowest(p,off))  {           /* local depression */
+					n++;
+					sum = 0; 
 					for (i=1;i<9;i++) {
-						neb = Elclip(hf1,ix+xo[i],iy+yo[i]);      /* neighbor elev. */
+						neb = p[off[i]];              /* neighbor elev. */
 						sum += neb;                   /* get sum of neighbor elevs */
 					}
+					wavg = sum / 8;               /* simple average */
+					El(hf2,t.x0+ix,t.y0+iy) = wavg;   /* hf2(x,y) <- weighted local avg */
+				} /* end if is_lowest()  */
+				else {    /* if not depression, just copy old mx to new */
+					El(hf2,t.x0+ix,t.y0+iy) = *p;
 				}
-				wavg = sum / 8;               /* simple average */
-				El(hf2,ix,iy) = wavg;       /* hf2(x,y) <- weighted local avg */
-			} /* end if is_lowest()  */
-			else {    /* if not depression, just copy old mx to new */
-				El(hf2,ix,iy) = El(hf1,ix,iy);
-			}
-		} /* end for ix */
-		/* printf("\n"); */
-	} /* end for iy */
-
-	return(count);
-}
+			} /* end for ix */
+		} /* end for iy */
+		__sync_fetch_and_add(&count, n);
+	}
+};
 
 /* ------------------------------------------------------------ */
-/* find_upflow -- find direction of stream flow at each lattice */
-/*                point, and set element of flag (uphill).      */
-/*                Must be called after find_flow2() so fl set.  */
+/*  fill_bn  --  fill in basins in heightfield area             */
+/*               input is hf1, output is in hf2                 */
 /* ------------------------------------------------------------ */
-static void find_upflow(hfield *h1, BYTE *fl, BYTE *flag, int tile)
+static int fill_bn(hfield *h2, hfield *h1)
 {
-	PTYPE *hf;
-	int xsize,ysize;
-	int x, y,i;
-	int xn, yn;
-	int tcounter;      /* counter to print 'wait dots' */
-	int dir;
-	int inflows;                    /* #nodes flowing in */
-	D mval;            /* current minimum elevation value */
-	D maxv;            /* current maximum */
-	D tval;            /* temporary value */
-
-	hf = h1->a;
-	xsize = h1->xsize;
-	ysize = h1->ysize;
-	tcounter = 0;
-	for (y = 0; y < ysize; y++) {
-		if (++tcounter>100) {
-			tcounter=0;
-		}
-		for (x = 0; x < xsize; x++)  {
-			mval = El(hf,x,y);          /* start with current point */
-			maxv = mval;
-			tval = El(hf,x,y);
-			El(flag,x,y) = 0;       /* 0 means point is a peak */
-			inflows = 0;            /* # neighbors pointing downhill to me */
-
-			for (i=1;i<9;i++) {
-				if (tile) tval = Elmod(hf,x+xo[i],y+yo[i]); /* neighbor higher? */
-				else tval = Elclip(hf,x+xo[i],y+yo[i]);
-	  
-				if (tval > maxv) {
-					maxv = tval;                /* yes, set uphill->this one */
-					El(flag,x,y) = i;
-				}
-				xn = x + xo[i];
-				yn = y + yo[i];
-				/* make sure not off edge of mx */
-				if ((xn >= 0) && (xn < xsize) && (yn >= 0) && (yn < ysize)) {
-					dir = El(fl,xn,yn);       /* inflow from here? */
-					if ((xo[i]+xo[dir]==0) && (yo[i]+yo[dir]==0)) { /* inflow! */
-						inflows++;
-					}
-				}  /* end if (inbounds) */
-			} /* end for i */
-	
-			if (inflows == 0) {     /* no inflows: find_ua can start here */
-				El(flag,x,y) = (El(flag,x,y) | 0x10);  /* set b4: summed */
-				/* printf("uflow %d,%d summed\n",x,y); */
-			}
-			/* and if we still think it's a peak...*/
-
-			if (El(flag,x,y)==0) {       /* supposed to be peak */
-				for(i=1;i<9;i++) {
-					if (tile) dir = Elmod(fl,x+xo[i],y+yo[i]);
-					else dir = Elclip(fl,x+xo[i],y+yo[i]);
-					if ((xo[i]+xo[dir]==0) && (yo[i]+yo[dir]==0)) { /* inflow! */
-						El(flag,x,y)=1;  /* arbitrary direction */
-					}
-				} /* end for i */
-			} /* end if d==0 */
+	int tile;
 
-		} /* end for x*/
-	} /* end for  y */
+	tile = h_tilable(h1, 0);  /* 1 if tilable, 0 if not */
+	fill_tiles ft(h2->a, h1->xsize);
+	h_partiles(ft, h1->a, h1->xsize, h1->ysize, 1, tile);
+
+	return(ft.count);
 }
 
 /* ----------------------------------------------------------   */
@@ -227,6 +140,9 @@ hfield *h_fillb(hfield *h1, int imax, D rate)  /* fill basin imax times */
 	int xsize, ysize;
 	int i,count;
 
+	h_sync(h1);
+	h_own(h1);					/* filled in place */
+
 	if(h1->c) {
 		fprintf(stderr, "ERROR: fillb: matrix is complex.\n");
 		return NULL;
@@ -242,11 +158,299 @@ hfield *h_fillb(hfield *h1, int imax, D rate)  /* fill basin imax times */
 	}
 
 	h_delete(h2);
-	h_minmax(h1);
+	h_dirty(h1);
+	return h1;
+}
+
+/* cell of the flood front: elevation and index into the HF */
+struct pf_cell {
+	PTYPE z;
+	U i;
+};
+
+/* binary min-heap of pf_cell, ordered by z */
+struct pf_heap {
+	pf_cell *c;
+	size_t n, max;
+
+	pf_heap() : c(NULL), n(0), max(0) { }
+	~pf_heap() { free(c); }
+	int push(PTYPE z, U i) {
+		size_t k, p;
+		pf_cell *nc;
+
+		if (n == max) {
+			if (!(nc = (pf_cell*)realloc(c, (max ? 2*max : 1024)*sizeof(pf_cell))))
+				return FALSE;
+			c = nc;
+			max = max ? 2*max : 1024;
+		}
+		for (k = n++; k > 0 && c[p = (k-1)/2].z > z; k = p)
+			c[k] = c[p];
+		c[k].z = z;
+		c[k].i = i;
+		return TRUE;
+	}
+	pf_cell pop() {
+		pf_cell top = c[0], last = c[--n];
+		size_t k = 0, j;
+
+		while ((j = 2*k+1) < n) {
+			if (j+1 < n && c[j+1].z < c[j].z)
+				j++;
+			if (!(c[j].z < last.z))
+				break;
+			c[k] = c[j];
+			k = j;
+		}
+		c[k] = last;
+		return top;
+	}
+};
+
+/* FIFO of cells raised to the level of the cell that reached them */
+struct pf_fifo {
+	U *q;
+	size_t head, n, max;
+
+	pf_fifo() : q(NULL), head(0), n(0), max(0) { }
+	~pf_fifo() { free(q); }
+	int push(U i) {
+		U *nq;
+		size_t k;
+
+		if (n == max) {			/* grow and unwrap */
+			if (!(nq = (U*)malloc((max ? 2*max : 1024)*sizeof(U))))
+				return FALSE;
+			for (k = 0; k < n; k++)
+				nq[k] = q[(head + k) % max];
+			free(q);
+			q = nq;
+			head = 0;
+			max = max ? 2*max : 1024;
+		}
+		q[(head + n++) % max] = i;
+		return TRUE;
+	}
+	U pop() {
+		U i = q[head];
+
+		head = (head + 1) % max;
+		n--;
+		return i;
+	}
+};
+
+/* ------------------------------------------------------------ */
+/* h_floodfill -- fill all basins in a single pass              */
+/*                                                              */
+/* Priority-flood (Barnes, Lehman & Mulla 2014): the flood      */
+/* starts at the outlets, i.e. the edges of a non-tiling HF or  */
+/* the lowest point of a tiling one, and always grows from the  */
+/* lowest cell of its front. A cell not higher than the one     */
+/* that reaches it lies in a basin and is raised to its level;  */
+/* those go through a FIFO instead of the heap. With eps each   */
+/* raised cell is made one ulp higher than its neighbour, so    */
+/* every pixel keeps a strictly downhill path to an outlet.     */
+/* The result is mixed with the input as rate*filled +          */
+/* (1-rate)*input.                                              */
+/* ------------------------------------------------------------ */
+hfield *h_floodfill(hfield *h1, D rate, int eps)
+{
+	int xsize, ysize;
+	int tile;
+	size_t npix, i;
+	int x, y, xn, yn, k;
+	U c, n;
+	PTYPE zc, lim;
+	PTYPE *z;             /* filled elevations */
+	BYTE *closed;         /* 1 if the flood has reached the cell */
+	pf_heap pq;
+	pf_fifo pit;
+	int ok = TRUE;
+
+	h_sync(h1);
+	h_own(h1);					/* filled in place */
+
+	if(h1->c) {
+		fprintf(stderr, "ERROR: floodfill: matrix is complex.\n");
+		return NULL;
+	}
+	xsize = h1->xsize;
+	ysize = h1->ysize;
+	npix = (size_t)xsize * ysize;
+	tile = h_tilable(h1, 0);
+
+	if (rate == 1) {
+		z = h1->a;
+	} else if (!(z = h_alloc(npix, FALSE))) {
+		fprintf(stderr, "ERROR: floodfill: out of memory.\n");
+		return NULL;
+	} else {
+		memcpy(z, h1->a, npix*sizeof(PTYPE));
+	}
+	if (!(closed = (BYTE*)calloc(npix, 1))) {
+		perror("ERROR: floodfill: calloc");
+		if (z != h1->a) h_free(z);
+		return NULL;
+	}
+
+	if (tile) {                 /* no edges; drains at the lowest point */
+		c = 0;
+		for (i = 1; i < npix; i++)
+			if (z[i] < z[c]) c = i;
+		closed[c] = 1;
+		ok = pq.push(z[c], c);
+	} else {                    /* drains over the edges */
+		for (y = 0; y < ysize && ok; y++)
+			for (x = 0; x < xsize && ok; x++) {
+				if (y > 0 && y < ysize-1 && x > 0 && x < xsize-1)
+					x = xsize-1;
+				c = y*xsize + x;
+				closed[c] = 1;
+				ok = pq.push(z[c], c);
+			}
+	}
+
+	while (ok && (pit.n || pq.n)) {
+		if (pit.n) {
+			c = pit.pop();
+			zc = z[c];
+		} else {
+			pf_cell top = pq.pop();
+			c = top.i;
+			zc = top.z;
+		}
+		lim = eps ? nextafterf(zc, FLT_MAX) : zc;
+		x = c % xsize;
+		y = c / xsize;
+		for (k = 1; k < 9; k++) {
+			xn = x + xo[k];
+			yn = y + yo[k];
+			if (tile) {
+				if (xn < 0) xn += xsize; else if (xn >= xsize) xn -= xsize;
+				if (yn < 0) yn += ysize; else if (yn >= ysize) yn -= ysize;
+			} else if (xn < 0 || xn >= xsize || yn < 0 || yn >= ysize) {
+				continue;
+			}
+			n = yn*xsize + xn;
+			if (closed[n])
+				continue;
+			closed[n] = 1;
+			if (z[n] <= lim) {      /* in a basin: raise to the spill level */
+				z[n] = lim;
+				ok = pit.push(n);
+			} else {
+				ok = pq.push(z[n], n);
+			}
+			if (!ok)
+				break;
+		}
+	}
+	free(closed);
+
+	if (!ok) {
+		fprintf(stderr, "ERROR: floodfill: out of memory.\n");
+		if (z != h1->a) h_free(z);
+		return NULL;
+	}
+	if (z != h1->a) {
+		for (i = 0; i < npix; i++)
+			h1->a[i] += rate*(z[i] - h1->a[i]);
+		h_free(z);
+	}
+	h_dirty(h1);
 	return h1;
 }
 
-#define BYTE unsigned char
+/*
+  Flow accumulation over the D8 receiver graph: every cell drains into
+  the neighbour fl[] points to, or nowhere if it is a sink or the flow
+  leaves a non-tiling HF. The graph has no cycles, since flow only goes
+  strictly downhill. deg[] counts the donors of each cell. Chains are
+  followed from the sources (cells without donors), adding the area to
+  the receiver, and continued from a receiver only by the thread that
+  adds its last donor; so every cell is visited once and threads need
+  nothing but atomic adds.
+*/
+#define UA_SOURCE	0x10		/* fl[] bit: cell had no donors */
+
+/* index of the cell x,y drains into, or -1 */
+static inline long receiver(const BYTE *fl, int x, int y, int xsize, int ysize, int tile)
+{
+	int dir = El(fl,x,y) & 0x0f;
+
+	if (!dir)
+		return -1;
+	x += xo[dir];
+	y += yo[dir];
+	if (tile) {
+		if (x < 0) x += xsize; else if (x >= xsize) x -= xsize;
+		if (y < 0) y += ysize; else if (y >= ysize) y -= ysize;
+	} else if (x < 0 || x >= xsize || y < 0 || y >= ysize) {
+		return -1;
+	}
+	return (long)y*xsize + x;
+}
+
+struct ua_rows : public hf_rows {
+	BYTE *fl, *deg;
+	U *area;
+	int xsize, ysize, tile;
+	int pass;
+
+	ua_rows(BYTE *f, BYTE *d, U *a, int x, int y, int t) :
+		fl(f), deg(d), area(a), xsize(x), ysize(y), tile(t), pass(0) { }
+	void run(U y0, U y1) {
+		int ix, iy;
+		long c, r;
+
+		for (iy = y0; iy < (int)y1; iy++) {
+			for (ix = 0; ix < xsize; ix++) {
+				c = (long)iy*xsize + ix;
+				switch (pass) {
+				case 0:			/* count donors */
+					area[c] = 1;
+					if ((r = receiver(fl, ix, iy, xsize, ysize, tile)) >= 0)
+						__sync_fetch_and_add(&deg[r], 1);
+					break;
+				case 1:			/* mark sources before any deg[] drops to 0 */
+					if (!deg[c])
+						fl[c] |= UA_SOURCE;
+					break;
+				case 2:			/* accumulate down the chain */
+					if (!(fl[c] & UA_SOURCE))
+						break;
+					while ((r = receiver(fl, c % xsize, c / xsize, xsize, ysize, tile)) >= 0) {
+						__sync_fetch_and_add(&area[r], area[c]);
+						if (__sync_sub_and_fetch(&deg[r], 1))
+							break;	/* other donors still to come */
+						c = r;
+					}
+					break;
+				}
+			}
+		}
+	}
+};
+
+/*
+  Flow directions (fl) and uphill area in pixels (area) of the a
+  xsize x ysize image. deg is scratch space of the same size.
+*/
+static void flow_area(const PTYPE *a, int xsize, int ysize, int tile,
+					  BYTE *fl, BYTE *deg, U *area)
+{
+	memset(deg, 0, (size_t)xsize * ysize);
+
+	flow_tiles ft(fl, xsize);
+	h_partiles(ft, a, xsize, ysize, 1, tile);
+
+	ua_rows ur(fl, deg, area, xsize, ysize, tile);
+	for (ur.pass = 0; ur.pass < 3; ur.pass++)
+		h_parfor(ur, ysize, xsize);
+}
+
 /* ------------------------------------------------------------ */
 /*    find_ua()  --  find uphill area for each mx element       */
 /*    that is, area or # of pixels which flow into this one     */
@@ -255,141 +459,366 @@ hfield *h_find_ua(hfield *h1)                /* find uphill area */
 {
 	hfield *h2;
 	int xsize, ysize;
-	int tile;
-	PTYPE *ua;            /* uphill area */
-	int ix,iy;
-	int i;
-	int tcounter;
-	int dir;              /* direction this element points in */
-	BYTE ff;               /* flag variable for this loc */
-	int o_summed;         /* flag indicating all neighbors summed */
-	long added;            /* # found unsummed nodes this pass */
-	float area;           /* sum of uphill area for this element */
-	size_t msize;         /* memory needed to alloc */
+	size_t npix, i;
 	BYTE *fl;             /* flow direction array */
-	BYTE *flag;
-	D slope;
+	BYTE *deg;            /* # of donors not yet summed */
+	U *area;              /* uphill area, in pixels */
 
-/* flag  matrix, b4 indicates this node summed 
-   ua    matrix, uphill area (pixel count) 
-   fl    matrix, direction of flow (downhill index)
-*/
+	h_sync(h1);
 
 	xsize = h1->xsize;
 	ysize = h1->ysize;
-	tile = h_tilable(h1, 0);
+	npix = (size_t)xsize * ysize;
 
-	msize = ((size_t) xsize * ysize * sizeof(char));
-	fl = (BYTE *) malloc( msize);
-	flag = (BYTE *) malloc( msize);
-	if ((fl == NULL) || (flag == NULL ))   {
+	fl = (BYTE *) malloc(npix);
+	deg = (BYTE *) malloc(npix);
+	area = (U *) malloc(npix * sizeof(U));
+	if (!fl || !deg || !area) {
 		perror("ERROR: find_ua: malloc");
-		if (fl!=NULL) free(fl);
-		if (flag!=NULL) free(flag);
+		free(fl); free(deg); free(area);
+		return NULL;
+	}
+	if(!(h2 = h_newr(xsize, ysize))) {
+		free(fl); free(deg); free(area);
 		return NULL;
 	}
-	memset(fl,(BYTE) 0, msize); /* ------ fl[]   now allocated ------- */
-	memset(flag,(BYTE) 0, msize); /* ---- flag[] now allocated ------- */
 
-	if(!(h2 = h_newr(xsize, ysize))) return NULL;
-	ua = h2->a;
+	flow_area(h1->a, xsize, ysize, h_tilable(h1, 0), fl, deg, area);
+	for (i = 0; i < npix; i++)
+		h2->a[i] = sqrt((D)area[i]);
+
+	free(area);
+	free(deg);
+	free(fl);
+	h_dirty(h2);
+	norm(h2, 0, 1);
+	return h2;
+}
+
+/* ------------------------------------------------------------ */
+/* h_erode -- time-stepped fluvial and thermal erosion          */
+/*                                                              */
+/* Every step recomputes flow directions and uphill area A and  */
+/* then, from the heights of the previous step:                 */
+/*  - incises each cell by stream power, k*dt*sqrt(A)*S, where  */
+/*    A is a fraction of the image and S the slope to its       */
+/*    receiver in heights per image width; at most half of the  */
+/*    drop to the receiver is removed, so no pits are dug;      */
+/*  - deposits the fraction dep of that material on the         */
+/*    receiver, the rest leaves as suspended load;              */
+/*  - moves material down any slope steeper than talus (again   */
+/*    per image width) to the neighbour, relaxing the excess.   */
+/* Deposition and slumping are gathered from the neighbours, so */
+/* the new heights go to a second buffer in one tile-parallel   */
+/* pass and the result doesn't depend on the number of threads. */
+/* ------------------------------------------------------------ */
+#define ERODE_THERMAL	0.0625	/* part of the excess slope moved per unit dt */
+
+/* e[] <- material incised from each cell */
+struct incise_rows : public hf_rows {
+	const PTYPE *z;
+	const BYTE *fl;
+	const U *area;
+	PTYPE *e;
+	int xsize, ysize, tile;
+	D kdt;						/* k*dt */
+	D anorm;					/* 1 / pixels in image */
+
+	incise_rows(const PTYPE *z_, const BYTE *f, const U *a, PTYPE *e_,
+				int x, int y, int t, D k) :
+		z(z_), fl(f), area(a), e(e_), xsize(x), ysize(y), tile(t),
+		kdt(k), anorm(1.0 / ((D)x*y)) { }
+	void run(U y0, U y1) {
+		int ix, iy, dir;
+		long c, r;
+		D drop, inc;
+
+		for (iy = y0; iy < (int)y1; iy++) {
+			for (ix = 0; ix < xsize; ix++) {
+				c = (long)iy*xsize + ix;
+				e[c] = 0;
+				if ((r = receiver(fl, ix, iy, xsize, ysize, tile)) < 0)
+					continue;
+				dir = fl[c] & 0x0f;
+				drop = z[c] - z[r];
+				inc = kdt * sqrt(area[c]*anorm) * drop * xsize;
+				if (dir & 1)	/* diagonal */
+					inc /= 1.414;
+				e[c] = MIN(inc, 0.5*drop);
+			}
+		}
+	}
+};
+
+/* z1 <- z0 - incision + deposition + thermal relaxation */
+struct erode_tiles : public hf_tiles {
+	PTYPE *z1;
+	const BYTE *fl;
+	const PTYPE *e;
+	int xsize, ysize, tile;
+	D dep;
+	D tlim[9];					/* talus height difference per direction */
+	D ct;						/* part of the excess moved */
+
+	erode_tiles(PTYPE *z, const BYTE *f, const PTYPE *e_, int x, int y, int t,
+				D talus, D d, D dt) :
+		z1(z), fl(f), e(e_), xsize(x), ysize(y), tile(t), dep(d) {
+		int i;
 
-	for (iy = 0; iy < ysize; iy++) { for (ix = 0; ix < xsize; ix++)  {
-		El(fl,ix,iy) = lowestn(h1,ix,iy,&slope,tile);
-	}  /* for x */ }  /* for y */     /* ------ fl[] now set ------- */
+		for (i = 1; i < 9; i++)
+			tlim[i] = talus / xsize * ((i & 1) ? 1.414 : 1.0);
+		ct = ERODE_THERMAL * MIN(dt, 1.0);
+	}
+	void run(hf_tile &t) {
+		int ix, iy, gx, gy, nx, ny, i;
+		long c;
+		D here, d, flux, sed;
+
+		for (iy = 0; iy < t.h; iy++) {
+			for (ix = 0; ix < t.w; ix++) {
+				gx = t.x0 + ix;
+				gy = t.y0 + iy;
+				c = (long)gy*xsize + gx;
+				here = Tl(t,ix,iy);
+				flux = 0;
+				sed = 0;
+				for (i = 1; i < 9; i++) {
+					nx = gx + xo[i];
+					ny = gy + yo[i];
+					if (!tile && (nx < 0 || nx >= xsize || ny < 0 || ny >= ysize))
+						continue;	/* nothing flows over the edge */
 
-	find_upflow(h1, fl, flag, tile);   /* ------- flag[] now set ---- */
-/* first pass: set local highpoints to "summed", area to 1 */
+					d = here - Tl(t,ix+xo[i],iy+yo[i]);
+					if (d > tlim[i])
+						flux -= ct*(d - tlim[i]);
+					else if (-d > tlim[i])
+						flux += ct*(-d - tlim[i]);
 
-	for (iy = 0; iy<ysize; iy++) {
-		for (ix = 0; ix<xsize; ix++) {
-			if ( (El(flag,ix,iy) & 0x10) == 0x10) { /* pre-summed (no inflows) */
-				El(ua,ix,iy) = 1;
-				/* printf("presummed %d %d\n",ix,iy); */
+					nx = h_edge(nx, xsize, tile);
+					ny = h_edge(ny, ysize, tile);
+					if ((El(fl,nx,ny) & 0x0f) == (i+3)%8 + 1)	/* drains here */
+						sed += e[(long)ny*xsize + nx];
+				}
+				z1[c] = here - e[c] + dep*sed + flux;
 			}
-			if ( (El(flag,ix,iy) & 0x0f) == 0) {   /* this point is a peak */
-				El(ua,ix,iy) = 1;                     /* peak: unit area */
-				El(flag,ix,iy) = (El(flag,ix,iy) | 0x10);  /* set b4: node summed */
-			} /* end if */
-		} /* end for ix */
-	} /* end for iy */
-
-/* 2nd through n passes: cumulative add areas in a downhill-flow hierarchy */
-	tcounter = 0;
-	added = 1;
-	while ( added > 0 ) {
-		added = 0;
-		for (iy = 1; iy<(ysize-1); iy++) {
-			for (ix = 1; ix<(xsize-1); ix++) {
-				ff = El(flag,ix,iy);
-				if (!(ff & 0x10)) {      /* flag bit b4: set = ua for this node done */
-					/* if all neighbors flowing into this node done, can sum */
-					o_summed = 1;           /* start assuming we're ok... 0=false*/
-					for(i=1;i<9;i++) {      /* check if relevant neighbors finished */
-						dir = El(fl,ix+xo[i],iy+yo[i]);
-						if ( ((xo[dir]+xo[i])==0) && ((yo[dir]+yo[i])==0))
-							/* ie,that node points here */
-							if (!(El(flag,ix+xo[i],iy+yo[i]) & 0x10))
-								o_summed = 0;
-					} /* end for i=1..8 */
-					if (o_summed) {
-						area = 1;
-						for (i=1;i<9;i++) {
-							dir = El(fl,ix+xo[i],iy+yo[i]);
-							if ( ((xo[dir]+xo[i])==0) && ((yo[dir]+yo[i])==0))
-								area += El(ua,ix+xo[i],iy+yo[i]);
-						}  /* end for i=1..9 */
-						El(ua,ix,iy) = area;
-						El(flag,ix,iy) = El(flag,ix,iy) | 0x10;  /* set b4: node summed */
-						added++;  /* increment count of nodes summed */
-					}  /* end if o_summed */
-
-				} /* end if b4 set */
-			}  /* end for x=1..xsize-1 */
-		} /* end for y=1..ysize-1 */
-
-		/* printf("before edges, added = %d ",added); */
-		/* aaand now... do the edges */
-/*   
-	 for (iy = 0; iy<ysize; iy++) {
-	 added += ua_iter(0,iy);
-	 added += ua_iter(xsize-1,iy);
-	 }
-	 for (ix = 1; ix<xsize-1; ix++) {
-	 added += ua_iter(ix,0);
-	 added += ua_iter(ix,ysize-1);
-	 }
-*/
-		/* printf("after %d, hit enter...\n",added); */
-		if (++tcounter > 10) {
-			tcounter=0;
 		}
-	} /* end while (added > 0) */
-	/*
-	  for(ix=0;ix<xsize;ix++) {
-	  for(iy=0;iy<ysize;iy++) {
-      dir = (int) El(fl,ix,iy);
-      switch (dir) {
-	  case 1: Im(ua,ix,iy) = 3*M_PI/2; break;
-	  case 2: Im(ua,ix,iy) = M_PI/2; break;
-	  case 3: Im(ua,ix,iy) = M_PI/4; break;
-	  case 4: Im(ua,ix,iy) = 0; break;
-	  case 5: Im(ua,ix,iy) = -M_PI/4; break;
-	  case 6: Im(ua,ix,iy) = -M_PI/2; break;
-	  case 7: Im(ua,ix,iy) = -3*M_PI/2; break;
-	  case 8: Im(ua,ix,iy) = M_PI; break;
-	  case 0: Im(ua,ix,iy) = 0; break;
-	  default:
-	  printf("Find_ua internal error: fl[] illegal value\n");
-	  return(1);
-      } 
-	  } 
-	  } 
-	*/
-	free(flag);
+	}
+};
+
+hfield *h_erode(hfield *h1, int iter, D dt, D k, D talus, D dep)
+{
+	int xsize, ysize;
+	int tile, i;
+	size_t npix;
+	PTYPE *z0, *z1, *e;   /* heights of this and next step, incision */
+	BYTE *fl, *deg;
+	U *area;
+
+	h_sync(h1);
+	h_own(h1);					/* eroded in place */
+
+	if(h1->c) {
+		fprintf(stderr, "ERROR: erode: matrix is complex.\n");
+		return NULL;
+	}
+	xsize = h1->xsize;
+	ysize = h1->ysize;
+	npix = (size_t)xsize * ysize;
+	tile = h_tilable(h1, 0);
+
+	fl = (BYTE *) malloc(npix);
+	deg = (BYTE *) malloc(npix);
+	area = (U *) malloc(npix * sizeof(U));
+	z1 = h_alloc(npix, FALSE);
+	e = h_alloc(npix, FALSE);
+	if (!fl || !deg || !area || !z1 || !e) {
+		fprintf(stderr, "ERROR: erode: out of memory.\n");
+		free(fl); free(deg); free(area);
+		if (z1) h_free(z1);
+		if (e) h_free(e);
+		return NULL;
+	}
+
+	z0 = h1->a;
+	for (i = 0; i < iter; i++) {
+		flow_area(z0, xsize, ysize, tile, fl, deg, area);
+
+		incise_rows ir(z0, fl, area, e, xsize, ysize, tile, k*dt);
+		h_parfor(ir, ysize, xsize);
+
+		erode_tiles et(z1, fl, e, xsize, ysize, tile, talus, dep, dt);
+		h_partiles(et, z0, xsize, ysize, 1, tile);
+
+		PTYPE *tmp = z0; z0 = z1; z1 = tmp;
+	}
+	if (z0 != h1->a) {          /* odd # of steps: result is in the work buffer */
+		memcpy(h1->a, z0, npix * sizeof(PTYPE));
+		z1 = z0;
+	}
+
+	h_free(z1);
+	h_free(e);
+	free(area);
+	free(deg);
 	free(fl);
-	h_minmax(h2);
-	h_oneop(h2, "pow", 0.5, 0);   /* take square root */
-	norm(h2, 0, 1);
-	return h2;
+	h_dirty(h1);
+	return h1;
+}
+
+/* ------------------------------------------------------------ */
+/* h_droplets -- hydraulic erosion by simulated rain drops      */
+/*                                                              */
+/* Each drop starts at a random point, rolls downhill with some */
+/* inertia, picks up sediment while it is faster and carries    */
+/* less than its capacity, and drops it where it slows down or  */
+/* the ground rises; it evaporates on the way (H. T. Beyer,     */
+/* "Implementation of a method for hydraulic erosion", 2015).   */
+/* Heights are read and changed bilinearly at the position of   */
+/* the drop. Drops run in batches on the thread pool; each      */
+/* batch has its own random stream, so the start points don't   */
+/* depend on the threads. Drops of different threads may touch  */
+/* the same pixels: updates are atomic adds and a drop reading  */
+/* a pixel another one is changing just sees it a moment early  */
+/* or late, which is harmless.                                  */
+/* ------------------------------------------------------------ */
+#define DROP_BATCH		1024	/* drops per random stream */
+#define DROP_LIFETIME	64		/* steps before a drop evaporates */
+#define DROP_RELIEF		8		/* height range is 1/8 of the width */
+#define DROP_MINSLOPE	0.01	/* slope for capacity on flat ground */
+#define DROP_GRAVITY	4.0
+#define DROP_ERODE		0.3		/* part of the free capacity picked up */
+#define DROP_DEPOSIT	0.3		/* part of the excess sediment dropped */
+
+static inline void atomic_addf(PTYPE *p, PTYPE v)
+{
+	union { PTYPE f; unsigned i; } o, n;
+
+	o.f = *p;
+	do {
+		n.f = o.f + v;
+	} while (!__atomic_compare_exchange_n((unsigned *)p, &o.i, n.i, true,
+										  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+struct drop_rows : public hf_rows {
+	PTYPE *z;
+	int xsize, ysize, tile;
+	U ndrops;
+	int seed;
+	D hs;						/* pixel heights -> drop heights */
+	D inertia, capacity, evap;
+
+	drop_rows(PTYPE *a, int x, int y, int t, U n, int s, D h, D in, D cap, D ev) :
+		z(a), xsize(x), ysize(y), tile(t), ndrops(n), seed(s), hs(h),
+		inertia(in), capacity(cap), evap(ev) { }
+
+	/* height and gradient at x,y; c <- top left pixel, u,v <- offsets */
+	D sample(D x, D y, long *c, D *u, D *v, D *gx, D *gy) {
+		int ix = (int)x, iy = (int)y;
+		int ix1 = ix+1, iy1 = iy+1;
+		D nw, ne, sw, se;
+
+		if (tile) {
+			if (ix1 == xsize) ix1 = 0;
+			if (iy1 == ysize) iy1 = 0;
+		}
+		*u = x - ix;
+		*v = y - iy;
+		c[0] = (long)iy*xsize + ix;  c[1] = (long)iy*xsize + ix1;
+		c[2] = (long)iy1*xsize + ix; c[3] = (long)iy1*xsize + ix1;
+		nw = z[c[0]] * hs; ne = z[c[1]] * hs;
+		sw = z[c[2]] * hs; se = z[c[3]] * hs;
+		*gx = (ne - nw)*(1 - *v) + (se - sw)*(*v);
+		*gy = (sw - nw)*(1 - *u) + (se - ne)*(*u);
+		return nw*(1-*u)*(1-*v) + ne*(*u)*(1-*v) + sw*(1-*u)*(*v) + se*(*u)*(*v);
+	}
+
+	/* add dh (in drop heights) at the sample c, u, v */
+	void deposit(const long *c, D u, D v, D dh) {
+		dh /= hs;
+		atomic_addf(&z[c[0]], dh*(1-u)*(1-v));
+		atomic_addf(&z[c[1]], dh*u*(1-v));
+		atomic_addf(&z[c[2]], dh*(1-u)*v);
+		atomic_addf(&z[c[3]], dh*u*v);
+	}
+
+	void run(U b0, U b1) {
+		hf_rng rng;
+		U b, i;
+		int step;
+		long c[4], c1[4];
+		D x, y, dx, dy, len, u, v, u1, v1, gx, gy, h, h1, dh;
+		D vel, water, sed, cap, amt;
+		D xmax = tile ? xsize : xsize-1, ymax = tile ? ysize : ysize-1;
+
+		for (b = b0; b < b1; b++) {
+			rng_seed(&rng, seed, b);
+			for (i = b*DROP_BATCH; i < MIN((b+1)*DROP_BATCH, ndrops); i++) {
+				x = rng_float(&rng) * xmax;
+				y = rng_float(&rng) * ymax;
+				dx = dy = 0;
+				vel = 1; water = 1; sed = 0;
+				for (step = 0; step < DROP_LIFETIME; step++) {
+					h = sample(x, y, c, &u, &v, &gx, &gy);
+					dx = dx*inertia - gx*(1-inertia);
+					dy = dy*inertia - gy*(1-inertia);
+					if ((len = sqrt(dx*dx + dy*dy)) == 0)
+						break;		/* flat: nowhere to go */
+					dx /= len; dy /= len;
+					x += dx; y += dy;
+					if (tile) {
+						if (x < 0) x += xsize; else if (x >= xsize) x -= xsize;
+						if (y < 0) y += ysize; else if (y >= ysize) y -= ysize;
+					} else if (x < 0 || x >= xmax || y < 0 || y >= ymax) {
+						break;		/* ran over the edge with its sediment */
+					}
+					h1 = sample(x, y, c1, &u1, &v1, &gx, &gy);
+					dh = h1 - h;
+
+					cap = MAX(-dh, DROP_MINSLOPE) * vel * water * capacity;
+					if (dh > 0 || sed > cap) {
+						/* uphill: fill the pit behind, else drop the excess */
+						amt = dh > 0 ? MIN(dh, sed) : (sed - cap) * DROP_DEPOSIT;
+						sed -= amt;
+						deposit(c, u, v, amt);
+					} else {
+						/* never dig deeper than the drop to the next point */
+						amt = MIN((cap - sed) * DROP_ERODE, -dh);
+						sed += amt;
+						deposit(c, u, v, -amt);
+					}
+					vel = sqrt(MAX(0.0, vel*vel - dh*DROP_GRAVITY));
+					water *= 1 - evap;
+				}
+			}
+		}
+	}
+};
+
+hfield *h_droplets(hfield *h1, int n, D inertia, D capacity, D evap)
+{
+	int seed;
+	D range;
+
+	h_range(h1);
+	h_own(h1);					/* eroded in place */
+
+	if(h1->c) {
+		fprintf(stderr, "ERROR: droplets: matrix is complex.\n");
+		return NULL;
+	}
+	if (n <= 0 || (range = h1->max - h1->min) <= 0)
+		return h1;
+
+	if (HF_PARAMS.rnd_seed_stale)
+		HF_PARAMS.rnd_seed = (int) (time(NULL) ^ 0xF37C)%1000000;
+	seed = HF_PARAMS.rnd_seed;
+	HF_PARAMS.rnd_seed_stale = TRUE;
+
+	drop_rows dr(h1->a, h1->xsize, h1->ysize, h_tilable(h1, 0), n, seed,
+				 h1->xsize / (DROP_RELIEF * range), inertia, capacity, evap);
+	h_parfor(dr, (n + DROP_BATCH-1) / DROP_BATCH, DROP_BATCH*DROP_LIFETIME);
+
+	h_dirty(h1);
+	return h1;
 }
@@ -0,0 +1,158 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * A chain like hf.add1(hf.mul1(hf.abs(X), 2), 1) used to make one full
+ * pass over the image per op, plus one more for h_minmax after each of
+ * them. Instead, h_op1 only appends a copy of the op to the pending list
+ * of the heightfield. The list is evaluated by h_sync() block by block,
+ * so that all ops and the min/max scan run while the block is in cache.
+ * Every operator that reads pixels calls h_sync() first (h_range() if it
+ * needs min/max too);
+ * h_op2 evaluates pending ops of its operands in the same pass as the
+ * binary op itself (see h_sync_span).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "hf-hl.h"
+#include "hf-sclxform.h"
+#include "hf-par.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define BLOCK 4096				/* pixels evaluated at once; 16k fits in L1 */
+
+struct hf_pending {
+	int n;						/* number of ops */
+	int size;					/* allocated slots */
+	scalar_op1 **op;			/* ops in order of application */
+};
+
+/**
+   Append op to the pending list of hf. Returns FALSE if the op can't be
+   deferred; the caller must then apply it immediately.
+*/
+int h_defer(hfield *hf, const scalar_op1 &op)
+{
+	hf_pending *p;
+	scalar_op1 *o;
+
+	if(!HF_PARAMS.defer || !(o = op.clone()))
+		return FALSE;
+
+	if(!(p = hf->pend)) {
+		if(!(p = (hf_pending*)calloc(1, sizeof(hf_pending)))) {
+			delete o;
+			return FALSE;
+		}
+		hf->pend = p;
+	}
+	if(p->n == p->size) {
+		int size = p->size ? 2*p->size : 8;
+		scalar_op1 **op2 = (scalar_op1**)realloc(p->op, size*sizeof(scalar_op1*));
+
+		if(!op2) {
+			delete o;
+			return FALSE;
+		}
+		p->op = op2;
+		p->size = size;
+	}
+	p->op[p->n++] = o;
+	return TRUE;
+}
+
+/**
+   Apply the pending ops of hf to n pixels at p (which must lie in the
+   real part of hf) and update the running min and max with the result;
+   start them at FLT_MAX and -FLT_MAX. The pending list is left intact; the caller drops it with h_drop()
+   after all pixels have been processed. Without pending ops only the
+   min/max are updated.
+*/
+void h_sync_span(hfield *hf, PTYPE *p, size_t n, PTYPE *min, PTYPE *max)
+{
+	hf_pending *pd = hf->pend;
+	PTYPE lo = *min, hi = *max;
+	size_t i, j, m;
+	int k;
+
+	for(i = 0; i < n; i += BLOCK) {
+		m = MIN(n-i, BLOCK);
+		if(pd)
+			for(k = 0; k < pd->n; k++)
+				pd->op[k]->apply(p+i, m);
+		for(j = i; j < i+m; j++) {
+			if(p[j] < lo) lo = p[j];
+			if(p[j] > hi) hi = p[j];
+		}
+	}
+	*min = lo; *max = hi;
+}
+
+struct sync_rows : public hf_rows {
+	hfield *hf;
+	hf_minmax acc;
+
+	sync_rows(hfield *h) : hf(h) { }
+	void run(U y0, U y1) {
+		PTYPE min = FLT_MAX, max = -FLT_MAX;
+
+		h_sync_span(hf, hf->a + (size_t)y0*hf->xsize,
+					(size_t)(y1-y0)*hf->xsize, &min, &max);
+		acc.merge(min, max);
+	}
+};
+
+/**
+   Evaluate all pending ops of hf and recompute its min and max.
+*/
+void h_sync(hfield *hf)
+{
+	if(!hf->pend)
+		return;
+	h_own(hf);					/* ops are applied in place */
+
+	sync_rows sr(hf);
+	h_parfor(sr, hf->ysize, hf->xsize);
+	h_setminmax(hf, sr.acc.min, sr.acc.max);
+	h_drop(hf);
+}
+
+/**
+   Forget the pending ops of hf without evaluating them.
+*/
+void h_drop(hfield *hf)
+{
+	hf_pending *p = hf->pend;
+	int i;
+
+	if(!p)
+		return;
+	for(i = 0; i < p->n; i++)
+		delete p->op[i];
+	free(p->op);
+	free(p);
+	hf->pend = NULL;
+}
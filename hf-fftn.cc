@@ -0,0 +1,658 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Multi-dimensional complex FFT and 2-D real FFT.
+ *
+ * All transforms are done in double precision on batches of FFT_B
+ * vectors at a time: a batch is gathered into a work buffer laid out as
+ * [n][FFT_B], so that the innermost loop of every butterfly runs over
+ * the batch and maps onto SIMD registers (GCC vector extensions). The
+ * transform itself is a mixed-radix Stockham autosort FFT (radix 4, 2,
+ * 3, 5 and a generic radix for other primes), which needs no bit
+ * reversal. Plans (factors and twiddles) are cached per (length, sign)
+ * and are read-only once built, so any number of threads can use them;
+ * each thread has its own work buffer. Batches are processed in
+ * parallel through h_parfor().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-fftn.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define FFT_B		8			/* vectors transformed together */
+#define FFT_MAXSTAGE 64
+
+#if defined(__AVX__)
+typedef double vd __attribute__((vector_size(32)));
+#define VL 4
+#else
+typedef double vd __attribute__((vector_size(16)));
+#define VL 2
+#endif
+#define V(p) (*(vd*)(p))
+
+struct fft_plan {
+	int n, sign;
+	int nstage;
+	int radix[FFT_MAXSTAGE];
+	double *tw[FFT_MAXSTAGE];	/* twiddles of stage: (p-1) per butterfly */
+	double *rot[FFT_MAXSTAGE];	/* p-th roots of unity for generic radix */
+	fft_plan *next;
+};
+
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static fft_plan *plans;
+
+static void plan_free(fft_plan *p)
+{
+	for(int i = 0; i < p->nstage; i++) {
+		free(p->tw[i]);
+		free(p->rot[i]);
+	}
+	free(p);
+}
+
+static fft_plan *plan_new(int n, int sign)
+{
+	fft_plan *p;
+	int m, r, i, j, k;
+	size_t len;
+
+	if(!(p = (fft_plan*)calloc(1, sizeof(fft_plan))))
+		return NULL;
+	p->n = n;
+	p->sign = sign;
+
+	for(m = n; m > 1; m /= r) {		/* factor n */
+		if(m % 4 == 0) r = 4;
+		else if(m % 2 == 0) r = 2;
+		else {
+			for(r = 3; r*r <= m && m % r; r += 2)
+				;
+			if(r*r > m) r = m;
+		}
+		p->radix[p->nstage++] = r;
+	}
+
+	len = n;
+	for(i = 0; i < p->nstage; i++) {
+		size_t mm;
+
+		r = p->radix[i];
+		mm = len / r;
+		if(!(p->tw[i] = (double*)malloc(2*mm*(r-1)*sizeof(double))))
+			goto nomem;
+		for(j = 0; j < (int)mm; j++)
+			for(k = 1; k < r; k++) {
+				double a = sign * 2*M_PI*j*k / len;
+				p->tw[i][2*(j*(r-1)+k-1)] = cos(a);
+				p->tw[i][2*(j*(r-1)+k-1)+1] = sin(a);
+			}
+		if(r > 5) {
+			if(!(p->rot[i] = (double*)malloc(2*r*sizeof(double))))
+				goto nomem;
+			for(k = 0; k < r; k++) {
+				p->rot[i][2*k] = cos(sign * 2*M_PI*k / r);
+				p->rot[i][2*k+1] = sin(sign * 2*M_PI*k / r);
+			}
+		}
+		len = mm;
+	}
+	return p;
+
+nomem:
+	plan_free(p);
+	return NULL;
+}
+
+/* find or make the plan for length n */
+static const fft_plan *plan_get(int n, int sign)
+{
+	fft_plan *p;
+
+	pthread_mutex_lock(&plan_lock);
+	for(p = plans; p; p = p->next)
+		if(p->n == n && p->sign == sign)
+			break;
+	if(!p && (p = plan_new(n, sign))) {
+		p->next = plans;
+		plans = p;
+	}
+	pthread_mutex_unlock(&plan_lock);
+	if(!p)
+		fputs("ERROR: fft: can't allocate plan\n", stderr);
+	return p;
+}
+
+void fft_free(void)
+{
+	fft_plan *p;
+
+	pthread_mutex_lock(&plan_lock);
+	while((p = plans)) {
+		plans = p->next;
+		plan_free(p);
+	}
+	pthread_mutex_unlock(&plan_lock);
+}
+
+/*
+  Stockham butterflies. The current stage transforms vectors of length
+  len = p*m; element j+r*m of x (r-th input of butterfly j) goes to element
+  p*j+k of y, multiplied by twiddle w^(jk). Each element is s consecutive
+  doubles (the batch, times p for every stage done so far).
+*/
+#define CMUL(dr, di, ar, ai, wr, wi) \
+	dr = (ar)*(wr) - (ai)*(wi); di = (ar)*(wi) + (ai)*(wr)
+
+static void radix2(size_t m, size_t s, const double *tw,
+				   const double *xr, const double *xi, double *yr, double *yi)
+{
+	for(size_t j = 0; j < m; j++) {
+		const double wr = tw[2*j], wi = tw[2*j+1];
+		const size_t i0 = s*j, i1 = s*(j+m), o0 = s*2*j, o1 = o0 + s;
+
+		for(size_t q = 0; q < s; q += VL) {
+			vd a0r = V(xr+i0+q), a0i = V(xi+i0+q);
+			vd a1r = V(xr+i1+q), a1i = V(xi+i1+q);
+			vd dr = a0r - a1r, di = a0i - a1i;
+
+			V(yr+o0+q) = a0r + a1r;
+			V(yi+o0+q) = a0i + a1i;
+			CMUL(V(yr+o1+q), V(yi+o1+q), dr, di, wr, wi);
+		}
+	}
+}
+
+static void radix3(size_t m, size_t s, int sign, const double *tw,
+				   const double *xr, const double *xi, double *yr, double *yi)
+{
+	const double s60 = sign * 0.86602540378443865;
+
+	for(size_t j = 0; j < m; j++) {
+		const double *w = tw + 4*j;
+		const size_t i0 = s*j, i1 = s*(j+m), i2 = s*(j+2*m);
+		const size_t o0 = s*3*j, o1 = o0+s, o2 = o1+s;
+
+		for(size_t q = 0; q < s; q += VL) {
+			vd a0r = V(xr+i0+q), a0i = V(xi+i0+q);
+			vd tr = V(xr+i1+q) + V(xr+i2+q), ti = V(xi+i1+q) + V(xi+i2+q);
+			vd dr = V(xr+i1+q) - V(xr+i2+q), di = V(xi+i1+q) - V(xi+i2+q);
+			vd cr = a0r - 0.5*tr, ci = a0i - 0.5*ti;
+			vd b1r = cr - s60*di, b1i = ci + s60*dr;	/* c + i*s60*d */
+			vd b2r = cr + s60*di, b2i = ci - s60*dr;
+
+			V(yr+o0+q) = a0r + tr;
+			V(yi+o0+q) = a0i + ti;
+			CMUL(V(yr+o1+q), V(yi+o1+q), b1r, b1i, w[0], w[1]);
+			CMUL(V(yr+o2+q), V(yi+o2+q), b2r, b2i, w[2], w[3]);
+		}
+	}
+}
+
+static void radix4(size_t m, size_t s, int sign, const double *tw,
+				   const double *xr, const double *xi, double *yr, double *yi)
+{
+	for(size_t j = 0; j < m; j++) {
+		const double *w = tw + 6*j;
+		const size_t i0 = s*j, i1 = s*(j+m), i2 = s*(j+2*m), i3 = s*(j+3*m);
+		const size_t o0 = s*4*j, o1 = o0+s, o2 = o1+s, o3 = o2+s;
+
+		for(size_t q = 0; q < s; q += VL) {
+			vd a0r = V(xr+i0+q), a0i = V(xi+i0+q);
+			vd a1r = V(xr+i1+q), a1i = V(xi+i1+q);
+			vd a2r = V(xr+i2+q), a2i = V(xi+i2+q);
+			vd a3r = V(xr+i3+q), a3i = V(xi+i3+q);
+			vd s02r = a0r + a2r, s02i = a0i + a2i;
+			vd d02r = a0r - a2r, d02i = a0i - a2i;
+			vd s13r = a1r + a3r, s13i = a1i + a3i;
+			vd d13r = a1r - a3r, d13i = a1i - a3i;
+			vd jr, ji, br, bi;
+
+			/* j = sign*i*(a1-a3) */
+			if(sign > 0) { jr = -d13i; ji = d13r; }
+			else { jr = d13i; ji = -d13r; }
+
+			V(yr+o0+q) = s02r + s13r;
+			V(yi+o0+q) = s02i + s13i;
+			br = d02r + jr; bi = d02i + ji;
+			CMUL(V(yr+o1+q), V(yi+o1+q), br, bi, w[0], w[1]);
+			br = s02r - s13r; bi = s02i - s13i;
+			CMUL(V(yr+o2+q), V(yi+o2+q), br, bi, w[2], w[3]);
+			br = d02r - jr; bi = d02i - ji;
+			CMUL(V(yr+o3+q), V(yi+o3+q), br, bi, w[4], w[5]);
+		}
+	}
+}
+
+static void radix5(size_t m, size_t s, int sign, const double *tw,
+				   const double *xr, const double *xi, double *yr, double *yi)
+{
+	const double c1 = 0.30901699437494742, s1 = sign * 0.95105651629515357;
+	const double c2 = -0.80901699437494742, s2 = sign * 0.58778525229247313;
+
+	for(size_t j = 0; j < m; j++) {
+		const double *w = tw + 8*j;
+		const size_t i0 = s*j, i1 = s*(j+m), i2 = s*(j+2*m), i3 = s*(j+3*m), i4 = s*(j+4*m);
+		const size_t o0 = s*5*j, o1 = o0+s, o2 = o1+s, o3 = o2+s, o4 = o3+s;
+
+		for(size_t q = 0; q < s; q += VL) {
+			vd a0r = V(xr+i0+q), a0i = V(xi+i0+q);
+			vd t1r = V(xr+i1+q) + V(xr+i4+q), t1i = V(xi+i1+q) + V(xi+i4+q);
+			vd t2r = V(xr+i2+q) + V(xr+i3+q), t2i = V(xi+i2+q) + V(xi+i3+q);
+			vd d1r = V(xr+i1+q) - V(xr+i4+q), d1i = V(xi+i1+q) - V(xi+i4+q);
+			vd d2r = V(xr+i2+q) - V(xr+i3+q), d2i = V(xi+i2+q) - V(xi+i3+q);
+			vd e1r = a0r + c1*t1r + c2*t2r, e1i = a0i + c1*t1i + c2*t2i;
+			vd e2r = a0r + c2*t1r + c1*t2r, e2i = a0i + c2*t1i + c1*t2i;
+			vd f1r = s1*d1r + s2*d2r, f1i = s1*d1i + s2*d2i;	/* times i below */
+			vd f2r = s2*d1r - s1*d2r, f2i = s2*d1i - s1*d2i;
+			vd br, bi;
+
+			V(yr+o0+q) = a0r + t1r + t2r;
+			V(yi+o0+q) = a0i + t1i + t2i;
+			br = e1r - f1i; bi = e1i + f1r;
+			CMUL(V(yr+o1+q), V(yi+o1+q), br, bi, w[0], w[1]);
+			br = e2r - f2i; bi = e2i + f2r;
+			CMUL(V(yr+o2+q), V(yi+o2+q), br, bi, w[2], w[3]);
+			br = e2r + f2i; bi = e2i - f2r;
+			CMUL(V(yr+o3+q), V(yi+o3+q), br, bi, w[4], w[5]);
+			br = e1r + f1i; bi = e1i - f1r;
+			CMUL(V(yr+o4+q), V(yi+o4+q), br, bi, w[6], w[7]);
+		}
+	}
+}
+
+/* any radix p: direct DFT of the p inputs */
+static void radixg(int p, size_t m, size_t s, const double *rot, const double *tw,
+				   const double *xr, const double *xi, double *yr, double *yi)
+{
+	for(size_t j = 0; j < m; j++) {
+		for(int k = 0; k < p; k++) {
+			const size_t o = s*(p*j+k);
+			const double wr = k ? tw[2*(j*(p-1)+k-1)] : 1;
+			const double wi = k ? tw[2*(j*(p-1)+k-1)+1] : 0;
+
+			for(size_t q = 0; q < s; q += VL) {
+				vd sr = V(xr+s*j+q), si = V(xi+s*j+q);
+
+				for(int r = 1, t = k; r < p; r++) {
+					const size_t i = s*(j+r*m)+q;
+					vd ar = V(xr+i), ai = V(xi+i);
+
+					sr += ar*rot[2*t] - ai*rot[2*t+1];
+					si += ar*rot[2*t+1] + ai*rot[2*t];
+					if((t += k) >= p) t -= p;
+				}
+				CMUL(V(yr+o+q), V(yi+o+q), sr, si, wr, wi);
+			}
+		}
+	}
+}
+
+/*
+  Transform the batch in (xr, xi). y is scratch of the same size. Returns
+  TRUE if the result is in x, FALSE if it is in y.
+*/
+static int fft_batch(const fft_plan *p, double *xr, double *xi, double *yr, double *yi)
+{
+	size_t len = p->n, s = FFT_B;
+	int inx = TRUE;
+
+	for(int i = 0; i < p->nstage; i++) {
+		int r = p->radix[i];
+		size_t m = len / r;
+
+		switch(r) {
+		case 2: radix2(m, s, p->tw[i], xr, xi, yr, yi); break;
+		case 3: radix3(m, s, p->sign, p->tw[i], xr, xi, yr, yi); break;
+		case 4: radix4(m, s, p->sign, p->tw[i], xr, xi, yr, yi); break;
+		case 5: radix5(m, s, p->sign, p->tw[i], xr, xi, yr, yi); break;
+		default: radixg(r, m, s, p->rot[i], p->tw[i], xr, xi, yr, yi); break;
+		}
+		double *t;
+		t = xr; xr = yr; yr = t;
+		t = xi; xi = yi; yi = t;
+		inx = !inx;
+		len = m;
+		s *= r;
+	}
+	return inx;
+}
+
+/* four work arrays of n*FFT_B doubles, aligned for vd */
+static double *work_alloc(size_t n)
+{
+	void *w;
+
+	if(posix_memalign(&w, 64, 4*n*FFT_B*sizeof(double)))
+		return NULL;
+	return (double*)w;
+}
+
+/*
+  One pass of a multi-dimensional transform: transform all vectors of
+  length n whose elements are 'inner' elements apart, in 'outer' blocks
+  of n*inner elements. Only the first 'width' vectors of each block are
+  transformed (width < inner for padded rows). 'step' is the distance
+  between consecutive complex values (1 normally, 2 for interleaved
+  data).
+*/
+template <class REAL>
+struct fft_pass : public hf_rows {
+	const fft_plan *plan;
+	REAL *re, *im;
+	size_t n, inner, width, outer, step;
+	size_t nbq;					/* batches per block */
+	double mul;					/* scale factor for the result */
+	volatile int err;
+
+	fft_pass(const fft_plan *p, REAL *r, REAL *i, size_t in, size_t w,
+			 size_t out, size_t st, double m) :
+		plan(p), re(r), im(i), n(p->n), inner(in), width(w), outer(out),
+		step(st), mul(m), err(0) {
+		nbq = (width + FFT_B-1) / FFT_B;
+	}
+	U batches() const {
+		return inner == 1 ? (outer + FFT_B-1) / FFT_B : outer * nbq;
+	}
+	void run(U g0, U g1);
+};
+
+template <class REAL>
+void fft_pass<REAL>::run(U g0, U g1)
+{
+	double *w = work_alloc(n), *xr, *xi, *yr, *yi, *rr, *ri;
+	size_t base[FFT_B], j;
+	int nv, b;
+
+	if(!w) {
+		err = 1;
+		return;
+	}
+	xr = w; xi = xr + n*FFT_B; yr = xi + n*FFT_B; yi = yr + n*FFT_B;
+
+	for(U g = g0; g < g1; g++) {
+		if(inner == 1) {		/* FFT_B consecutive vectors */
+			nv = MIN(FFT_B, outer - (size_t)g*FFT_B);
+			for(b = 0; b < nv; b++)
+				base[b] = ((size_t)g*FFT_B + b) * n;
+		} else {				/* FFT_B adjacent columns of a block */
+			size_t o = g / nbq, q0 = (g % nbq) * FFT_B;
+			nv = MIN(FFT_B, width - q0);
+			for(b = 0; b < nv; b++)
+				base[b] = o*n*inner + q0 + b;
+		}
+
+		for(j = 0; j < n; j++) {
+			for(b = 0; b < nv; b++) {
+				size_t i = (base[b] + j*inner) * step;
+				xr[j*FFT_B+b] = re[i];
+				xi[j*FFT_B+b] = im[i];
+			}
+			for(; b < FFT_B; b++)
+				xr[j*FFT_B+b] = xi[j*FFT_B+b] = 0;
+		}
+
+		if(fft_batch(plan, xr, xi, yr, yi)) {
+			rr = xr; ri = xi;
+		} else {
+			rr = yr; ri = yi;
+		}
+
+		for(j = 0; j < n; j++)
+			for(b = 0; b < nv; b++) {
+				size_t i = (base[b] + j*inner) * step;
+				re[i] = rr[j*FFT_B+b] * mul;
+				im[i] = ri[j*FFT_B+b] * mul;
+			}
+	}
+	free(w);
+}
+
+/* multiplier implementing the 'scaling' argument */
+static double fft_mul(double scaling, size_t ntotal)
+{
+	if(scaling && scaling != 1.0) {
+		if(scaling < 0.0)
+			scaling = (scaling < -1.0) ? sqrt((double)ntotal) : ntotal;
+		return 1.0 / scaling;
+	}
+	return 1.0;
+}
+
+/* transform the given dimension; returns 0 or -1 */
+template <class REAL>
+static int fft_dim(REAL *re, REAL *im, size_t n, size_t inner, size_t width,
+				   size_t outer, int isign, double mul)
+{
+	const fft_plan *p;
+	int step = isign < 0 ? -isign : isign;
+
+	if(n < 2 && mul == 1.0)
+		return 0;
+	if(!(p = plan_get(n, isign < 0 ? -1 : 1)))
+		return -1;
+
+	fft_pass<REAL> pass(p, re, im, inner, width, outer, step, mul);
+	h_parfor(pass, pass.batches(), n*FFT_B);
+	if(pass.err) {
+		fputs("ERROR: fft: out of memory\n", stderr);
+		return -1;
+	}
+	return 0;
+}
+
+template <class REAL>
+static int fft_nd(int ndim, const int dims[], REAL Re[], REAL Im[],
+				  int isign, double scaling, const char *name)
+{
+	size_t ntotal = 1, inner = 1;
+	int i;
+
+	if(!ndim || !dims[0])		/* zero-terminated dims */
+		for(ndim = 0; dims[ndim]; ndim++)
+			;
+	for(i = 0; i < ndim; i++) {
+		if(dims[i] <= 0) {
+			fprintf(stderr, "Error: %s() - dimension error\n", name);
+			return -1;
+		}
+		ntotal *= dims[i];
+	}
+	if(!isign) {
+		fprintf(stderr, "Error: %s() - isign must be non-zero\n", name);
+		return -1;
+	}
+
+	for(i = 0; i < ndim; i++) {
+		size_t n = dims[i];
+		double mul = (i == ndim-1) ? fft_mul(scaling, ntotal) : 1.0;
+
+		if(fft_dim(Re, Im, n, inner, inner, ntotal / (n*inner), isign, mul))
+			return -1;
+		inner *= n;
+	}
+	return 0;
+}
+
+int fftn(int ndim, const int dims[], double Re[], double Im[], int isign, double scaling)
+{
+	return fft_nd(ndim, dims, Re, Im, isign, scaling, "fftn");
+}
+
+int fftnf(int ndim, const int dims[], float Re[], float Im[], int isign, double scaling)
+{
+	return fft_nd(ndim, dims, Re, Im, isign, scaling, "fftnf");
+}
+
+/*
+  Row pass of the real transforms. Two real rows a, b are transformed at
+  once as the complex row z = a + ib; their spectra are separated using
+  A(k) = (Z(k) + conj Z(n-k))/2, B(k) = (Z(k) - conj Z(n-k))/2i. The
+  inverse does the opposite: Z(k) = A(k) + iB(k) with A and B extended
+  to the full length by Hermitian symmetry. Rows are nx long, half
+  spectra hw = nx/2+1. Real rows are ldr apart, spectrum rows lds apart.
+  Each batch reads all its rows before writing any, so the real data
+  may share memory with the spectrum as long as every real row lies
+  within the corresponding spectrum rows.
+*/
+struct fft_rpass : public hf_rows {
+	const fft_plan *plan;
+	float *real, *re, *im;
+	size_t nx, ny, hw, ldr, lds;
+	int inverse;
+	double mul;
+	volatile int err;
+
+	fft_rpass(const fft_plan *p, float *r, size_t lr, float *sr, float *si,
+			  size_t ls, size_t x, size_t y, int inv, double m) :
+		plan(p), real(r), re(sr), im(si), nx(x), ny(y), hw(x/2+1),
+		ldr(lr), lds(ls), inverse(inv), mul(m), err(0) { }
+	U batches() const {
+		return (ny + 2*FFT_B-1) / (2*FFT_B);
+	}
+	void run(U g0, U g1);
+};
+
+void fft_rpass::run(U g0, U g1)
+{
+	double *w = work_alloc(nx), *xr, *xi, *yr, *yi, *rr, *ri;
+	size_t j, k, y, y1;
+	int b;
+
+	if(!w) {
+		err = 1;
+		return;
+	}
+	xr = w; xi = xr + nx*FFT_B; yr = xi + nx*FFT_B; yi = yr + nx*FFT_B;
+
+	for(U g = g0; g < g1; g++) {
+		for(b = 0; b < FFT_B; b++) {	/* gather rows y and y+1 */
+			y = (size_t)g*2*FFT_B + 2*b;
+			y1 = y+1;
+			for(j = 0; j < nx; j++) {
+				double ar = 0, ai = 0, br = 0, bi = 0;
+
+				if(!inverse) {
+					if(y < ny) ar = real[y*ldr+j];
+					if(y1 < ny) br = real[y1*ldr+j];
+					xr[j*FFT_B+b] = ar;
+					xi[j*FFT_B+b] = br;
+					continue;
+				}
+				k = j < hw ? j : nx-j;
+				if(y < ny) { ar = re[y*lds+k]; ai = im[y*lds+k]; }
+				if(y1 < ny) { br = re[y1*lds+k]; bi = im[y1*lds+k]; }
+				if(k == 0 || 2*k == nx) {	/* must be real */
+					ai = bi = 0;
+				} else if(j != k) {		/* conjugate half */
+					ai = -ai; bi = -bi;
+				}
+				xr[j*FFT_B+b] = ar - bi;
+				xi[j*FFT_B+b] = ai + br;
+			}
+		}
+
+		if(fft_batch(plan, xr, xi, yr, yi)) {
+			rr = xr; ri = xi;
+		} else {
+			rr = yr; ri = yi;
+		}
+
+		for(b = 0; b < FFT_B; b++) {	/* scatter */
+			y = (size_t)g*2*FFT_B + 2*b;
+			y1 = y+1;
+			if(y >= ny)
+				break;
+			if(inverse) {
+				for(j = 0; j < nx; j++) {
+					real[y*ldr+j] = rr[j*FFT_B+b] * mul;
+					if(y1 < ny) real[y1*ldr+j] = ri[j*FFT_B+b] * mul;
+				}
+				continue;
+			}
+			for(k = 0; k < hw; k++) {
+				size_t nk = k ? nx-k : 0;
+				double zr = rr[k*FFT_B+b], zi = ri[k*FFT_B+b];
+				double nr = rr[nk*FFT_B+b], ni = ri[nk*FFT_B+b];
+
+				re[y*lds+k] = 0.5*(zr + nr) * mul;
+				im[y*lds+k] = 0.5*(zi - ni) * mul;
+				if(y1 < ny) {
+					re[y1*lds+k] = 0.5*(zi + ni) * mul;
+					im[y1*lds+k] = 0.5*(nr - zr) * mul;
+				}
+			}
+		}
+	}
+	free(w);
+}
+
+static int fft_rows(float real[], int ldr, float Re[], float Im[], int lds,
+					int nx, int ny, int isign, int inverse, double mul)
+{
+	const fft_plan *p;
+
+	if(!(p = plan_get(nx, isign < 0 ? -1 : 1)))
+		return -1;
+
+	fft_rpass pass(p, real, ldr, Re, Im, lds, nx, ny, inverse, mul);
+	h_parfor(pass, pass.batches(), 2*nx*FFT_B);
+	if(pass.err) {
+		fputs("ERROR: fft: out of memory\n", stderr);
+		return -1;
+	}
+	return 0;
+}
+
+int fftrf(int nx, int ny, const float in[], int ldi, float Re[], float Im[],
+		  int lds, int isign, double scaling)
+{
+	if(nx <= 0 || ny <= 0 || !isign || ldi < nx || lds < nx/2+1) {
+		fputs("Error: fftrf() - dimension error\n", stderr);
+		return -1;
+	}
+	if(fft_rows(const_cast<float*>(in), ldi, Re, Im, lds, nx, ny, isign, FALSE, 1.0))
+		return -1;
+	return fft_dim(Re, Im, ny, lds, nx/2+1, 1, isign, fft_mul(scaling, (size_t)nx*ny));
+}
+
+int fftcrf(int nx, int ny, float Re[], float Im[], int lds, float out[], int ldo,
+		   int isign, double scaling)
+{
+	if(nx <= 0 || ny <= 0 || !isign || ldo < nx || lds < nx/2+1) {
+		fputs("Error: fftcrf() - dimension error\n", stderr);
+		return -1;
+	}
+	if(fft_dim(Re, Im, ny, lds, nx/2+1, 1, isign, 1.0))
+		return -1;
+	return fft_rows(out, ldo, Re, Im, lds, nx, ny, isign, TRUE,
+					fft_mul(scaling, (size_t)nx*ny));
+}
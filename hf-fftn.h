@@ -13,6 +13,8 @@
  *      scaling == -1, normalize by total dimension of the transform
  *      scaling <  -1, normalize by the square-root of the total dimension
  *
+ * Plans are cached; fft_free() releases them.
+ *
  * ----------------------------------------------------------------------
  * See the comments in the code for correct usage!
  */
@@ -32,6 +34,19 @@ int fftn (int ndim, const int dims[], double Re[], double Im[], int isign, doubl
 /* float precision routine */
 int fftnf (int ndim, const int dims[], float Re[], float Im[], int isign, double scaling);
 
+/*
+ * 2-D transforms of real data. The nx*ny real values are stored in rows
+ * ldi (ldo) apart; the spectrum is stored in Re[] and Im[] as ny rows of
+ * nx/2+1 values, lds apart (the other half follows from Hermitian
+ * symmetry). fftcrf overwrites Re[] and Im[]; out[] may overlap them if
+ * every output row lies within its spectrum rows, e.g. for an in-place
+ * transform with Im = Re + nx/2+1 and lds = ldo = 2*(nx/2+1).
+ */
+int fftrf (int nx, int ny, const float in[], int ldi, float Re[], float Im[],
+		   int lds, int isign, double scaling);
+int fftcrf (int nx, int ny, float Re[], float Im[], int lds, float out[], int ldo,
+			int isign, double scaling);
+
 #ifdef __cplusplus
 }
 #endif
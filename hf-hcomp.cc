@@ -3,6 +3,9 @@
 #include <math.h>
 #include <string.h>
 #include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-simd.h"
+#include "hf-tile.h"
 
 static char rcsid[] UNUSED = "$Id: hf-hcomp.cc,v 1.1.2.3 2003/12/31 15:25:18 zvrba Exp $";
 
@@ -36,19 +39,48 @@ static char rcsid[] UNUSED = "$Id: hf-hcomp.cc,v 1.1.2.3 2003/12/31 15:25:18 zvr
  *  global: histbins   number of histogram bins
  * -------------------------------------------------------------------
  */
+struct histeq_rows : public hf_rows {
+	const PTYPE *hf;
+	PTYPE *h2;
+	int xsize;
+	const PTYPE *trans;
+	int bins;
+	D range, hmin;
+
+	histeq_rows(const PTYPE *a, PTYPE *b, int x, const PTYPE *t, int nb, D r, D m) :
+		hf(a), h2(b), xsize(x), trans(t), bins(nb), range(r), hmin(m) { }
+	void run(U y0, U y1) {
+		D tmp, fpart;
+		int ix, iy, in;
+
+		for (iy = y0; iy<(int)y1; iy++) {
+			for (ix = 0; ix<xsize; ix++) {
+				tmp = (D)El(hf,ix,iy);
+				in = (int)(tmp * (D) bins);	/* integer index */
+				if (in > (bins-1)) in = bins-1;
+				fpart = (tmp * (D)bins) - (D)in;       /* fractional part */
+				tmp = INTERPOLATE(trans[in],trans[in+1],fpart);
+				El(h2,ix,iy) = (range * tmp) + hmin;
+			}
+		}
+	}
+};
+
 hfield *histeq(hfield *h1, PTYPE frac)
 {
 	hfield *h2;
-	D tmp, range, fpart, linpart;
+	D tmp, range, linpart;
 	D hmin, hmax;                  /* extrema of HF */
 	int xsize, ysize;                /* dimension of this hf */
-	int ix, iy, in;
+	int ix, iy;
 	size_t memsize;
 	PTYPE *trans;
 	PTYPE *hf;                     /* working heightfield array */
 	long * hist;                   /* histogram array */
 	int bins;                      /* number of bins */
 
+	h_range(h1);
+
 	if (h1->c) {
 		fprintf(stderr, "ERROR: histeq: matrix is complex.\n");
 		return NULL;
@@ -108,22 +140,13 @@ hfield *histeq(hfield *h1, PTYPE frac)
       printf("%d: %1.3f\n",ix,trans[ix]);
 	  }
 	*/
-	fpart = 0;
-	for (iy = 0; iy<ysize; iy++) {     /* do the equalization */
-		for (ix = 0; ix<xsize; ix++) {
-			tmp = (D)El(hf,ix,iy);
-			in = (int)(tmp * (D) bins);	/* integer index */
-			if (in > (bins-1)) in = bins-1;
-			fpart = (tmp * (D)bins) - (D)in;       /* fractional part */
-			tmp = INTERPOLATE(trans[in],trans[in+1],fpart);
-			El(h2->a,ix,iy) = (range * tmp) + hmin;
-		}
-	}
+	histeq_rows eq(hf, h2->a, xsize, trans, bins, range, hmin);
+	h_parfor(eq, ysize, xsize);         /* do the equalization */
 
 	free(trans);
 	free(hist);
 
-	h_minmax(h2);
+	h_dirty(h2);
 	return h2;
 }
 
@@ -188,6 +211,8 @@ void h_hist(hfield *hfin, int bins)                  /* display a histogram */
 	long *hist = (long*)NULL;  /* histogram array */
 	long hf_max;
 	D sfac;
+
+	h_range(hfin);
  
 	screenx = 79;
 	screeny = 20;
@@ -229,6 +254,8 @@ hfield *h_hshift(hfield *hf, PTYPE shift)
 	long hf_max;
 	PTYPE hpeak; /* HF elevation value (+/-.5 bin size) of greatest population */
 
+	h_range(hf);
+
 	bins = HF_PARAMS.histbins;
 	if(!hh_hist(hf, bins, &hist)) {
 		fprintf(stderr, "ERROR: h_hshift: histogram function failed.\n");
@@ -255,18 +282,42 @@ hfield *h_hshift(hfield *hf, PTYPE shift)
 
 hfield *negate(hfield *hf)
 { 
+	h_range(hf);
 	return norm(hf, hf->max, hf->min);
 }
 
+struct norm_rows : public hf_rows {
+	PTYPE *hf;
+	int xsize;
+	PTYPE scalefac, offset, min;
+	hf_minmax acc;
+
+	norm_rows(PTYPE *a, int x, PTYPE s, PTYPE o, PTYPE m) :
+		hf(a), xsize(x), scalefac(s), offset(o), min(m), acc(FLT_MAX, FLT_MIN) { }
+	void run(U y0, U y1) {
+		PTYPE hmin = FLT_MAX, hmax = FLT_MIN, tmp;
+		int ix,iy;
+
+		for (iy=y0;iy<(int)y1;iy++) {
+			for (ix=0;ix<xsize;ix++) {
+				tmp = (El(hf,ix,iy) + offset) * scalefac + min;
+				El(hf,ix,iy) = tmp;
+				if (tmp > hmax) hmax = tmp;
+				if (tmp < hmin) hmin = tmp;
+			}
+		}
+		acc.merge(hmin, hmax);
+	}
+};
+
 hfield *norm(hfield *hfin, PTYPE min, PTYPE max)
 {
-	int ix,iy;
 	int xsize, ysize;
 	PTYPE scalefac, offset;
-	PTYPE *hf;
-	PTYPE hmin, hmax, tmp;
 
-	hf = hfin->a;
+	h_range(hfin);
+	h_own(hfin);
+
 	xsize = hfin->xsize;
 	ysize = hfin->ysize;
 	if(hfin->max == hfin->min) {
@@ -274,21 +325,13 @@ hfield *norm(hfield *hfin, PTYPE min, PTYPE max)
 		return NULL;
 	}
 	if(hfin->c) fprintf(stderr, "WARNING: norm: normalizing real part only.\n");
-	hmin = FLT_MAX;
-	hmax = FLT_MIN;
 	offset = -hfin->min;
 	scalefac = (max-min) / (hfin->max - hfin->min);
-	for (ix=0;ix<xsize;ix++) {
-		for (iy=0;iy<ysize;iy++) {
-			tmp = (El(hf,ix,iy) + offset) * scalefac + min;
-			El(hf,ix,iy) = tmp;
-			if (tmp > hmax) hmax = tmp;
-			if (tmp < hmin) hmin = tmp;
-		}
-	}
 
-	hfin->max = hmax;
-	hfin->min = hmin;
+	norm_rows nr(hfin->a, xsize, scalefac, offset, min);
+	h_parfor(nr, ysize, xsize);
+
+	h_setminmax(hfin, nr.acc.min, nr.acc.max);
 	return hfin;
 }
 
@@ -307,6 +350,9 @@ hfield *h_composit(hfield *h1, hfield *h2, char *opn, int xo, int yo) /* HF comb
 	D ht1,ht2,ht3;      /* temp HF values */
 	D sval;             /* horizontal line integral */
 
+	h_sync(h1);
+	h_sync(h2);
+
 	xsize = xsize1 = h1->xsize;      /* X hf */
 	xsize = ysize1 = h1->ysize;
 	xsize2 = h2->xsize;      /* Y hf */
@@ -414,7 +460,7 @@ hfield *h_composit(hfield *h1, hfield *h2, char *opn, int xo, int yo) /* HF comb
 		}   /* end else */
 	} /* end if cflag */
 	
-	h_minmax(h3);
+	h_dirty(h3);
 	return h3;
 }
 
@@ -427,6 +473,9 @@ hfield *h_oneop(hfield *h1, char *opn, D fac, D fac2) /* single- HF ops */
 	D ht1, ht3=0;
 	D sf2,sf3;              /* floor/ceiling added threshold scale factor */
 
+	h_range(h1);
+	h_own(h1);
+
 	xsize = h1->xsize;
 	ysize = h1->ysize;
 	cflag = h1->c;
@@ -513,19 +562,47 @@ hfield *h_oneop(hfield *h1, char *opn, D fac, D fac2) /* single- HF ops */
 		}  /* end for ix */
 	}  /* end for iy */
 
-	h_minmax(h1);
+	h_dirty(h1);
 	return h1;
 }
 
+struct diff_tiles : public hf_tiles {
+	PTYPE *h1;
+	int xsize;					/* for El */
+	int op;
+
+	diff_tiles(PTYPE *a1, int x, int o) : h1(a1), xsize(x), op(o) { }
+	void run(hf_tile &t) {
+		int ix, iy;
+		D ht0, ht1=0;
+		D tmp1,tmp2;
+
+		for (iy = 0;iy<t.h;iy++) {
+			for (ix=0;ix<t.w;ix++) {
+				ht0 = Tl(t,ix,iy);
+				if (op==DIFF) {
+					ht1 = sqrt(pow(ht0-Tl(t,ix-1,iy),2)
+							   + pow(ht0-Tl(t,ix,iy-1),2));
+				}
+				else if (op==DIF2) {
+					tmp1 = (Tl(t,ix-1,iy)+Tl(t,ix+1,iy))/2;
+					tmp2 = (Tl(t,ix,iy-1)+Tl(t,ix,iy+1))/2;
+					ht1 = sqrt(pow(ht0-tmp1,2)+pow(ht0-tmp2,2));
+				}
+				El(h1,t.x0+ix,t.y0+iy) = ht1;
+			} /* for ix */
+		} /* for iy */
+	}
+};
+
 hfield *h_diff(hfield *h0, const char *opn)
 {
 	int op;
 	int tile;
 	int xsize, ysize;
 	hfield *h1;
-	int ix, iy;
-	D ht0, ht1=0;
-	D tmp1,tmp2;
+
+	h_sync(h0);
 
 	xsize = h0->xsize;
 	ysize = h0->ysize;
@@ -542,79 +619,30 @@ hfield *h_diff(hfield *h0, const char *opn)
 		return NULL;
 	}
 	if(!(h1 = h_newr(xsize,ysize))) return NULL;
-	for (iy = 0;iy<ysize;iy++) {
-		for (ix=0;ix<xsize;ix++) {
-			ht0 = El(h0->a,ix,iy);
-			if (op==DIFF) {
-				if (tile)
-					ht1 = sqrt(pow(ht0-Elmod(h0->a,ix-1,iy),2)
-							   + pow(ht0-Elmod(h0->a,ix,iy-1),2));
-				else
-					ht1 = sqrt(pow(ht0-Elclip(h0->a,ix-1,iy),2)
-							   + pow(ht0-Elclip(h0->a,ix,iy-1),2));
-			}
-			else if (op==DIF2) {
-				if (tile) {
-					tmp1 = (Elmod(h0->a,ix-1,iy)+Elmod(h0->a,ix+1,iy))/2;
-					tmp2 = (Elmod(h0->a,ix,iy-1)+Elmod(h0->a,ix,iy+1))/2;
-				} else {
-					tmp1 = (Elclip(h0->a,ix-1,iy)+Elclip(h0->a,ix+1,iy))/2;
-					tmp2 = (Elclip(h0->a,ix,iy-1)+Elclip(h0->a,ix,iy+1))/2;
-				}
-				ht1 = sqrt(pow(ht0-tmp1,2)+pow(ht0-tmp2,2));
-			}
-			El(h1->a,ix,iy) = ht1;
-		} /* for ix */
-	} /* for iy */
+
+	diff_tiles dt(h1->a, xsize, op);
+	h_partiles(dt, h0->a, xsize, ysize, 1, tile);
   
-	h_minmax(h1);
+	h_dirty(h1);
 	return h1;
 }
 		 
-static int h_slope2(hfield *h1, hfield *h0,int op,int tile, D thresh, int iter)
-{
-	int xsize, ysize;
-	int ix, iy;
-	int changed;
-	D ht0, ht1=0;
-	D htx,hty,htx1,hty1;   /* values of HF elements on either side of this one */
-  
-	xsize = h0->xsize;
-	ysize = h0->ysize;
-	changed = 0;   /* number of elements averaged this pass */
-  
-	for (iy = 0;iy<ysize;iy++) {
-		for (ix = 0;ix<xsize;ix++) {
-			ht0 = El(h0->a,ix,iy);
-			if (op==DIFF) {       /* calculate mag(x,y) slope at ix,iy */
-				if (tile) {htx =  Elmod(h0->a,ix-1,iy); hty= Elmod(h0->a,ix,iy-1);}
-				else    {htx = Elclip(h0->a,ix-1,iy); hty=Elclip(h0->a,ix,iy-1);}
-				ht1 = sqrt(pow((ht0-htx),2) + pow((ht0-hty),2) );
-				if (ht1 > thresh) {  /* yes, slope exceeds threshold */
-					if (tile) {htx1 =  Elmod(h0->a,ix+1,iy); hty1= Elmod(h0->a,ix,iy+1);}
-					else    {htx1 = Elclip(h0->a,ix+1,iy); hty1=Elclip(h0->a,ix,iy+1);}
-					ht1 = (htx + htx1 + hty + hty1)/4.0;
-					changed++;
-				} else ht1 = ht0;
-			} else if (op==DIF2) {
-				if (tile) {
-					htx =  Elmod(h0->a,ix-1,iy); hty= Elmod(h0->a,ix,iy-1);
-					htx1 =  Elmod(h0->a,ix+1,iy); hty1= Elmod(h0->a,ix,iy+1);
-				} else {
-					htx = Elclip(h0->a,ix-1,iy); hty=Elclip(h0->a,ix,iy-1);
-					htx1 = Elclip(h0->a,ix+1,iy); hty1=Elclip(h0->a,ix,iy+1);
-				}
-				ht1 = sqrt(pow(ht0-(htx+htx1)/2,2)+pow(ht0-(hty+hty1)/2,2));
-				if (ht1 > thresh) {
-					ht1 = (htx + htx1 + hty + hty1)/4.0;
-					changed++;
-				} else ht1 = ht0;
-			}
-			El(h1->a,ix,iy) = ht1;
-		} /* for ix */
-	} /* for iy */
-	return(changed);
-}
+/* one pass of slopelim: average where the slope or curvature exceeds thresh */
+struct slope_sweep : public hf_sweep {
+	int curv;
+	D t2;						/* thresh^2, or -1 for any slope */
+
+	slope_sweep(int c, D t) : curv(c), t2(t < 0 ? -1 : t*t) { }
+	U run(const hf_tile &src, hf_tile &dst, int x0, int y0, int w, int h) {
+		U n = 0;
+		int y;
+
+		for (y = y0; y < y0+h; y++)
+			n += v_slopelim(&Tl(src,x0,y), &Tl(src,x0,y-1), &Tl(src,x0,y+1),
+							&Tl(dst,x0,y), w, curv, t2);
+		return n;
+	}
+};
 
 hfield *h_slopelim(hfield *h0, const char *opn,D thresh, int iter)  /* slope-dependent smoothing */
 {
@@ -622,8 +650,11 @@ hfield *h_slopelim(hfield *h0, const char *opn,D thresh, int iter)  /* slope-dep
 	int tile;
 	int xsize, ysize;
 	hfield *h1;
-	int repcount=0;
-	int changed;
+	hf_tile t[2];
+	int n;
+
+	h_sync(h0);
+	h_own(h0);					/* smoothed in place too */
 
 	xsize = h0->xsize;
 	ysize = h0->ysize;
@@ -640,87 +671,197 @@ hfield *h_slopelim(hfield *h0, const char *opn,D thresh, int iter)  /* slope-dep
 		return NULL;
 	}
 	if(!(h1 = h_newr(xsize, ysize))) return NULL;
+	if(!h_pad(&t[0], h0->a, xsize, ysize, 1, tile)) {
+		h_delete(h1);
+		return NULL;
+	}
+	if(!h_pad(&t[1], NULL, xsize, ysize, 1, tile)) {
+		h_unpad(&t[0]);
+		h_delete(h1);
+		return NULL;
+	}
 
-	do {
-		h_slope2(h1,h0,op,tile,thresh,iter);
-		changed = h_slope2(h0,h1,op,tile,thresh,iter);
-	} while (changed > 0  &&  ++repcount<iter);
+	/* iter times h0 -> h1 -> h0, until nothing changes */
+	slope_sweep sw(op == DIF2, thresh);
+	n = h_iterate(sw, &t[0], &t[1], 2*MAX(iter, 1), tile);
+	h_tile_store(&t[n & 1], h0->a, xsize);
+	h_tile_store(&t[(n+1) & 1], h1->a, xsize);
+	h_unpad(&t[0]);
+	h_unpad(&t[1]);
 
-	h_minmax(h1);
+	h_dirty(h0);
+	h_dirty(h1);
 	return h1;
 }
 
+struct minmax_rows : public hf_rows {
+	const PTYPE *hf;
+	int xsize;
+	hf_minmax acc;
+
+	minmax_rows(const PTYPE *a, int x) : hf(a), xsize(x), acc(a[0], a[0]) { }
+	void run(U y0, U y1) {
+		PTYPE hmin = hf[0], hmax = hf[0];
+
+		v_minmax(&El(hf,0,y0), (size_t)(y1-y0)*xsize, &hmin, &hmax);
+		acc.merge(hmin, hmax);
+	}
+};
+
 		 /* Find minimum and maximum values in current array. */
 void h_minmax(hfield *hfin)
 {
-	PTYPE hmin, hmax, tmp;
-	int ix,iy,xsize,ysize;
-	PTYPE *hf = hfin->a;
+	if(hfin->pend) {		/* evaluates ops and min/max in one pass */
+		h_sync(hfin);
+		return;
+	}
 
-	hmax = El(hf,0,0);    /* initialize extrema to first data value */
-	hmin = El(hf,0,0);
-	xsize = hfin->xsize;
-	ysize = hfin->ysize;
+	/* extrema are initialized to first data value */
+	minmax_rows mm(hfin->a, hfin->xsize);
+	h_parfor(mm, hfin->ysize, hfin->xsize);
+	h_setminmax(hfin, mm.acc.min, mm.acc.max);
+}
 
-	for (iy = 0; iy<ysize; iy++) {
-		for (ix = 0; ix<xsize; ix++) {
-			tmp = (double)El(hf,ix,iy);
-			if (tmp > hmax) hmax = tmp;
-			if (tmp < hmin) hmin = tmp;
-		}
-	}
-	hfin->min = hmin;
-	hfin->max = hmax;
+/*
+  Mark min/max (and imin/imax) of hf as out of date after its pixels
+  were changed. They are recomputed only when something asks for them
+  (h_range, i_minmax), so a chain of operators doesn't make a separate
+  pass over each intermediate result just to find its extrema.
+*/
+void h_dirty(hfield *hf)
+{
+	hf->stale = STALE_R | STALE_I;
+}
+
+/* Make min/max of hf up to date; every reader of min/max calls this. */
+void h_range(hfield *hf)
+{
+	h_sync(hf);
+	if(hf->stale & STALE_R)
+		h_minmax(hf);
 }
 
+		 /* find min,max of imag.vals; cached in imin/imax */
 void i_minmax(hfield *hf,D *min,D *max)
 {
-	D hmin, hmax, tmp;
-	int ix,iy,xsize,ysize;
-	PTYPE *h = hf->a;
+	h_sync(hf);
 
 	if(!hf->c) {
 		*min=0; *max=0; return;
 	}
-	xsize = hf->xsize;
-	ysize = hf->ysize;
-	hmax = Im(h,0,0);    /* initialize extrema to first data value */
-	hmin = Im(h,0,0);
-
-	for (iy = 0; iy<ysize; iy++) {
-		for (ix = 0; ix<xsize; ix++) {
-			tmp = (double)Im(h,ix,iy);
-			if (tmp > hmax) hmax = tmp;
-			if (tmp < hmin) hmin = tmp;
-		}
+	if(hf->stale & STALE_I) {
+		int xsize = hf->xsize, ysize = hf->ysize;	/* for Im() */
+		minmax_rows mm(&Im(hf->a,0,0), xsize);
+
+		h_parfor(mm, ysize, xsize);
+		hf->imin = mm.acc.min;
+		hf->imax = mm.acc.max;
+		hf->stale &= ~STALE_I;
 	}
-	*min = hmin;
-	*max = hmax;
-	return;
+	*min = hf->imin;
+	*max = hf->imax;
 }
 
+		 /* find min,max of real.vals */
 void r_minmax(hfield *hf,D *min,D *max)
 {
-	D hmin, hmax, tmp;
-	int ix,iy,xsize,ysize;
-	PTYPE *h = hf->a;
-
-	xsize = hf->xsize;
-	ysize = hf->ysize;
-	hmax = El(h,0,0);    /* initialize extrema to first data value */
-	hmin = El(h,0,0);
+	h_range(hf);
+	*min = hf->min;
+	*max = hf->max;
+}
 
-	for (iy = 0; iy<ysize; iy++) {
-		for (ix = 0; ix<xsize; ix++) {
-			tmp = (double)El(h,ix,iy);
-			if (tmp > hmax) hmax = tmp;
-			if (tmp < hmin) hmin = tmp;
+/*
+  Count, mean and sum of squared deviations of a set of pixels, merged
+  from partial results with the pairwise formula of Chan et al. Each row
+  is summed relative to its own first pixel, so a large offset of the
+  heights doesn't cancel out the variance.
+*/
+struct stats_acc {
+	D n, mean, m2;
+
+	stats_acc() : n(0), mean(0), m2(0) { }
+	void merge(D n1, D mean1, D m21) {
+		D delta, tot;
+
+		if(n1 == 0)
+			return;
+		tot = n + n1;
+		delta = mean1 - mean;
+		mean += delta*n1/tot;
+		m2 += m21 + delta*delta*n*n1/tot;
+		n = tot;
+	}
+};
+
+struct stats_rows : public hf_rows {
+	const PTYPE *hf;
+	int xsize;
+	hf_minmax mm;
+	stats_acc acc;
+	U nan;
+	pthread_mutex_t lock;		/* protects acc, nan */
+
+	stats_rows(const PTYPE *a, int x) : hf(a), xsize(x), nan(0) {
+		pthread_mutex_init(&lock, NULL);
+	}
+	~stats_rows() {
+		pthread_mutex_destroy(&lock);
+	}
+	void run(U y0, U y1) {
+		PTYPE hmin = FLT_MAX, hmax = -FLT_MAX;
+		stats_acc part;
+		const PTYPE *row;
+		D k, s1, s2, n;
+		U bad = 0, b;
+		U iy;
+
+		for (iy = y0; iy < y1; iy++) {
+			row = &El(hf,0,iy);
+			k = row[0] == row[0] ? row[0] : 0;
+			s1 = s2 = 0;
+			b = v_stats(row, xsize, k, &hmin, &hmax, &s1, &s2);
+			if ((n = xsize - b) > 0)
+				part.merge(n, k + s1/n, s2 - s1*s1/n);
+			bad += b;
 		}
+		mm.merge(hmin, hmax);
+		pthread_mutex_lock(&lock);
+		acc.merge(part.n, part.mean, part.m2);
+		nan += bad;
+		pthread_mutex_unlock(&lock);
 	}
-	*min = hmin;
-	*max = hmax;
+};
+
+/*
+  Min, max, mean, variance and number of NaNs of the real part, all in
+  one pass. NaN pixels are left out of the others; if there are none,
+  min/max of hf are brought up to date on the way.
+*/
+hf_stats h_stats(hfield *hf)
+{
+	hf_stats st;
+
+	h_sync(hf);
+
+	stats_rows sr(hf->a, hf->xsize);
+	h_parfor(sr, hf->ysize, hf->xsize);
+
+	st.n = (U)sr.acc.n;
+	st.nan = sr.nan;
+	if (st.n) {
+		st.min = sr.mm.min;
+		st.max = sr.mm.max;
+		st.mean = sr.acc.mean;
+		st.var = sr.acc.m2 / sr.acc.n;
+	} else {
+		st.min = st.max = st.mean = st.var = NAN;
+	}
+	if (!st.nan)
+		h_setminmax(hf, sr.mm.min, sr.mm.max);
+	return st;
 }
 
+
 /* is_tilable()  --  Returns 1 if current matrix will tile seamlessly */
 /*                   Returns 0 if it won't  */
 int is_tilable(hfield *hfin, int pflag)
@@ -731,6 +872,8 @@ int is_tilable(hfield *hfin, int pflag)
 	PTYPE *hf;
 	int retval;
 
+	h_sync(hfin);
+
 	if (pflag==0) {
 		if (HF_PARAMS.tile_mode == TON) return(1);
 		if (HF_PARAMS.tile_mode == TOFF) return(0);
@@ -739,6 +882,7 @@ int is_tilable(hfield *hfin, int pflag)
 	hf = hfin->a;
 	xsize = hfin->xsize;
 	ysize = hfin->ysize;
+	h_range(hfin);
 	range = (hfin->max - hfin->min);
 	if (range==0) range=1;
 
@@ -784,7 +928,10 @@ int h_tilable(hfield *hfin, int pflag)
 	D xdiff, ydiff, range;
 	int ix,iy,xsize,ysize;
 	int retval;
-	PTYPE *hf = hfin->a;
+	PTYPE *hf;
+
+	h_sync(hfin);
+	hf = hfin->a;
 
 	if (pflag==0) {
 		if (HF_PARAMS.tile_mode == TON) return(1);
@@ -793,6 +940,7 @@ int h_tilable(hfield *hfin, int pflag)
 
 	xsize = hfin->xsize;
 	ysize = hfin->ysize;
+	h_range(hfin);
 	range = (hfin->max - hfin->min);
 	if (range==0) range=1;
 
@@ -838,6 +986,8 @@ hfield *h_peak(hfield *hf0, D xpos, D ypos)             /* slew HF to locate pea
 	D tmp,hmax;
 	hfield *hf1;
 
+	h_sync(hf0);
+
 	xsize = hf0->xsize;
 	ysize = hf0->ysize;
 	if(hf0->c) {
@@ -846,8 +996,6 @@ hfield *h_peak(hfield *hf0, D xpos, D ypos)             /* slew HF to locate pea
 	}
 
 	if(!(hf1 = h_newr(xsize,ysize))) return NULL;
-	hf1->min = hf0->min;  
-	hf1->max = hf0->max;
 
 	xpeak = xsize/2;          /* should not be necessary, i hope */
 	ypeak = ysize/2;
@@ -875,7 +1023,9 @@ hfield *h_peak(hfield *hf0, D xpos, D ypos)             /* slew HF to locate pea
 		}
 	}
 
-	h_minmax(hf1);
+	/* same values, moved around */
+	if (hf0->stale & STALE_R) h_dirty(hf1);
+	else h_setminmax(hf1, hf0->min, hf0->max);
 	return hf1;
 }
 
@@ -886,6 +1036,8 @@ hfield *h_rotate(hfield *hf1, int deg)              /* rotate 90,180,270 degrees
 	int x,y;
 	hfield *hf2;
 
+	h_sync(hf1);
+
 	if((deg!=90)&&(deg!=180)&&(deg!=270)) {
 		fprintf(stderr, "ERROR: rotate: only supports 90, 180, or 270 degree rotations.\n");
 		return NULL;
@@ -905,8 +1057,6 @@ hfield *h_rotate(hfield *hf1, int deg)              /* rotate 90,180,270 degrees
 		ysize2 = xsize;
 	}
 	if(!(hf2 = h_newr(xsize2,ysize2))) return NULL;
-	hf2->min = hf1->min;
-	hf2->max = hf1->max;
 
 	if (deg==90) {
 		for (y=0;y<ysize;y++) {
@@ -931,7 +1081,9 @@ hfield *h_rotate(hfield *hf1, int deg)              /* rotate 90,180,270 degrees
 		return NULL;
 	}
 
-	h_minmax(hf2);
+	/* same values, moved around */
+	if (hf1->stale & STALE_R) h_dirty(hf2);
+	else h_setminmax(hf2, hf1->min, hf1->max);
 	return hf2;
 }
 
@@ -951,7 +1103,7 @@ hfield *h_const(int xsize, int ysize, D value)  /* create a new constant HF */
  
 	if(!(hf = h_newr(xsize,ysize))) return NULL;
 	for (x=0;x<xsize;x++) for (y=0;y<ysize;y++) El(hf->a,x,y)=value;
-	hf->min = hf->max = value;
+	h_setminmax(hf, value, value);
 	return hf;
 }
 
@@ -36,62 +36,144 @@ struct HF_PARAMS HF_PARAMS = {
 	1000,						/* histbins */
 	AUTO,						/* tile_mode */
 	0.01,						/* tile_tol */
-	4.0							/* gaufac */
+	4.0,						/* gaufac */
+	TRUE,						/* defer */
+	0,							/* threads */
+	256							/* pool */
 };
 
-hfield *h_newr(int xs, int ys)	/* create real HF */
+/*
+  Create a real (c = FALSE) or complex HF. The pixels are cleared only if
+  zero is TRUE; callers that overwrite all of them pass FALSE.
+*/
+hfield *h_new(int xs, int ys, int c, int zero)
 {
 	PTYPE *a;
-	size_t mem;
+	size_t n;
 	hfield *hf = (hfield*)malloc(sizeof(hfield));
 
-	mem = (size_t)xs*ys*sizeof(PTYPE);
-	if(hf && (a = (float*)malloc(mem))) { 
-		memset(a, 0, mem);
+	n = (size_t)xs*ys*(c ? 2 : 1);
+	if(hf && (a = h_alloc(n, zero))) {
 		hf->a = a;
 		hf->xsize = xs;
 		hf->ysize = ys;
-		hf->c = 0;
+		hf->c = c;
+		hf->rxsize = 0;
 		hf->max = hf->min = 0;
+		hf->imax = hf->imin = 0;
+		hf->stale = zero ? 0 : STALE_R | STALE_I;
+		hf->pend = NULL;
 	} else {
-		perror("ERROR: h_newr: malloc");
+		perror("ERROR: h_new: malloc");
 		free(hf);
 		hf = NULL;
 	}
 	return hf;
 }
 
+hfield *h_newr(int xs, int ys)	/* create real HF */
+{
+	return h_new(xs, ys, FALSE, TRUE);
+}
+
 hfield *h_newc(int xs, int ys)	/* create complex HF */
 {
-	PTYPE *a;
-	size_t mem;
+	return h_new(xs, ys, TRUE, TRUE);
+}
+
+/*
+  Create the half spectrum of a real rxs*ys HF: a complex HF of
+  (rxs/2+1)*ys values. The other half follows from Hermitian symmetry.
+*/
+hfield *h_newh(int rxs, int ys)
+{
+	hfield *hf;
+
+	if((hf = h_newc(rxs/2+1, ys)))
+		hf->rxsize = rxs;
+	return hf;
+}
+
+/*
+  Create a real HF from xs*ys values in a (from h_alloc), stored in rows
+  ld >= xs apart. The array is packed and shrunk in place and owned by
+  the HF afterwards.
+*/
+hfield *h_packr(PTYPE *a, int xs, int ys, int ld)
+{
 	hfield *hf = (hfield*)malloc(sizeof(hfield));
- 
-	mem = (size_t)xs*ys*2*sizeof(PTYPE);
-	if(hf && (a = (float*)malloc(mem))) { 
-		memset(a, 0, mem);
-		hf->a = a;
-		hf->xsize = xs;
-		hf->ysize = ys;
-		hf->c = 1;
-		hf->max = hf->min = 0;
-	} else {
-		perror("ERROR: h_newc: malloc");
-		free(hf);
-		hf = NULL;
+	int y;
+
+	if(!hf) {
+		perror("ERROR: h_packr: malloc");
+		h_free(a);
+		return NULL;
 	}
+	if(ld != xs) {
+		for(y = 1; y < ys; y++)
+			memmove(a + (size_t)y*xs, a + (size_t)y*ld, xs*sizeof(PTYPE));
+		a = h_shrink(a, (size_t)xs*ys);
+	}
+	hf->a = a;
+	hf->xsize = xs;
+	hf->ysize = ys;
+	hf->c = 0;
+	hf->rxsize = 0;
+	hf->max = hf->min = 0;
+	hf->imax = hf->imin = 0;
+	hf->stale = STALE_R | STALE_I;
+	hf->pend = NULL;
 	return hf;
 }
 
+/*
+  Create a new HF sharing the pixels of hf. Both can be used and deleted
+  independently; whichever is modified first gets its own copy (h_own).
+*/
+hfield *h_dup(hfield *hf)
+{
+	hfield *hd = (hfield*)malloc(sizeof(hfield));
+
+	if(!hd) {
+		perror("ERROR: h_dup: malloc");
+		return NULL;
+	}
+	h_sync(hf);
+	memcpy(hd, hf, sizeof(hfield));
+	h_ref(hf->a);
+	return hd;
+}
+
+/*
+  Make sure that nothing else uses the pixels of hf. Every operator that
+  modifies its input in place calls this first.
+*/
+void h_own(hfield *hf)
+{
+	size_t n = (size_t)hf->xsize*hf->ysize*(hf->c ? 2 : 1);
+	PTYPE *a;
+
+	if(!h_shared(hf->a))
+		return;
+	if(!(a = h_alloc(n, FALSE))) {
+		fprintf(stderr, "FATAL: h_own: out of memory\n");
+		exit(1);
+	}
+	memcpy(a, hf->a, n*sizeof(PTYPE));
+	h_free(hf->a);
+	hf->a = a;
+}
+
 void h_delete(hfield *hf)
 {
-	free(hf->a);
+	h_drop(hf);
+	h_free(hf->a);
 	free(hf);
 }
 
 void h_assign_free(hfield *dst, hfield *src)
 {
-	free(dst->a);
+	h_free(dst->a);
 	memcpy(dst, src, sizeof(hfield));
 	free(src);
 }
@@ -12,6 +12,7 @@
 #define UNUSED
 #endif
 
+#include <stddef.h>
 #include <math.h>
 #include <float.h>
 
@@ -31,17 +32,43 @@
 #define U unsigned int
 #define PTYPE float   /* data-type of heightfield (pixel) values */ 
 
+struct hfield;
+struct hf_pending;				/* deferred pointwise ops; hf-expr.cc */
+void h_sync(struct hfield *hf);	/* evaluate deferred ops */
+void h_range(struct hfield *hf);	/* make min/max up to date */
+
+/* hfield::stale bits */
+#define STALE_R 1				/* min/max out of date */
+#define STALE_I 2				/* imin/imax out of date */
+
 struct hfield {					/* Heightfield structure type */
 	PTYPE *a;					/* 2-D array of values */
 	U xsize;
 	U ysize;					/* x- and y-dimensions of array */
 	PTYPE min;
 	PTYPE max;					/* max and min values in array */
+	PTYPE imin;
+	PTYPE imax;					/* same for the imag. part, if c */
+	int stale;					/* STALE_* bits; see h_range, i_minmax */
 	int c;				/* TRUE if matrix is complex, FALSE if real */
+	U rxsize;		/* real width if a is a half spectrum (h_newh), else 0 */
+	struct hf_pending *pend;	/* ops not yet applied to a, or NULL */
 
 #ifdef __cplusplus				// Lua scripting
+	// a may change (h_own) or be shared (h_dup); the struct itself doesn't
 	bool operator==(const hfield &hf) const {
-		return a == hf.a;
+		return this == &hf;
+	}
+
+	// min/max are computed on demand
+	PTYPE _min() {
+		h_range(this);
+		return min;
+	}
+
+	PTYPE _max() {
+		h_range(this);
+		return max;
 	}
 
 	const char *_type() const {
@@ -49,7 +76,7 @@ struct hfield {					/* Heightfield structure type */
 	}
 
 	unsigned long _hkey() const {
-		return (unsigned long)a;
+		return (unsigned long)this;
 	}
 #endif
 };
@@ -62,6 +89,9 @@ extern struct HF_PARAMS {
 	int tile_mode;				/* tiling mode: on/off/auto */
 	D   tile_tol;				/* tiling edge threshold tolerance */
 	D   gaufac;					/* sigmas along gaussian */
+	int defer;					/* defer pointwise ops until needed */
+	int threads;				/* worker threads, 0 = one per processor */
+	int pool;					/* MB of freed pixel buffers kept for reuse */
 	
 #ifdef __cplusplus				// Lua scripting
 	const char *_type() const {
@@ -70,6 +100,28 @@ extern struct HF_PARAMS {
 #endif
 } HF_PARAMS;
 
+/* statistics of the real part of a HF, see h_stats */
+struct hf_stats {
+	D min, max;					/* extrema */
+	D mean, var;				/* mean and (population) variance */
+	U n;						/* number of pixels that are not NaN */
+	U nan;						/* number of NaN pixels */
+
+#ifdef __cplusplus				// Lua scripting
+	const char *_type() const {
+		return "hf_stats";
+	}
+#endif
+};
+
+/* set min/max of the real part, e.g. as computed along with the pixels */
+static inline void h_setminmax(hfield *hf, PTYPE min, PTYPE max)
+{
+	hf->min = min;
+	hf->max = max;
+	hf->stale &= ~STALE_R;
+}
+
 #define ABS(a)          (((a)<0) ? -(a) : (a))
 #define ROUND(a)        ((a)>0 ? (int)((a)+0.5) : -(int)(0.5-(a)))
 #define ZSGN(a)         (((a)<0) ? -1 : (a)>0 ? 1 : 0)  
@@ -80,17 +132,33 @@ extern struct HF_PARAMS {
 #define INTERPOLATE(x,y,frac)  (1-(frac))*(x) + (frac)*(y)
 
 /* ------------------- hl.c -------------------------- */
+hfield *h_new(int xs, int ys, int c, int zero); /* zero: clear the pixels */
 hfield *h_newr(int xs, int ys);
 hfield *h_newc(int xs, int ys);
+hfield *h_newh(int rxs, int ys);	/* create half spectrum of rxs*ys real HF */
+hfield *h_packr(PTYPE *a, int xs, int ys, int ld); /* real HF from rows ld apart */
+hfield *h_dup(hfield *hf);		/* new HF sharing the pixels of hf */
+void h_own(hfield *hf);			/* unshare pixels of hf before writing to them */
 void h_delete(hfield*);
+void h_drop(hfield *hf);		/* discard deferred ops (hf-expr.cc) */
 //void h_assign_free(hfield *dst, hfield *src);
 
+/* --- mem.cc: pooled, reference counted pixel buffers ----- */
+PTYPE *h_alloc(size_t n, int zero);
+PTYPE *h_shrink(PTYPE *a, size_t n);
+void h_ref(PTYPE *a);
+int h_shared(const PTYPE *a);
+void h_free(PTYPE *a);
+void h_trim(void);				/* release pooled buffers */
+
 /* --- hcomp.c -------------------------------------- */
 hfield *h_oneop(hfield *h1, char *opn, D fac, D fac2); /* single- HF ops */
 hfield *h_composit(hfield *h1, hfield *h2, char *opn, int xo, int yo); /* HF comb. taking two operands */
 void h_minmax(hfield *hfin);                       /* set min,max values of array */
+void h_dirty(hfield *hf);		/* pixels changed; min/max computed when needed */
 void i_minmax(hfield *hf,D *mx,D *mn);  /* find min,max of imag.vals */
 void r_minmax(hfield *hf,D *mx,D *mn);  /* find min,max of real.vals */
+hf_stats h_stats(hfield *hf);	/* min, max, mean, var, NaNs in one pass */
 hfield *histeq(hfield *h1, PTYPE frac); /* histogram equalization */
 void h_hist(hfield *hfin, int bins);                  /* display a histogram */
 hfield *h_hshift(hfield *hf, PTYPE shift); /* offset HF so hist. peak at SHIFT */
@@ -106,6 +174,19 @@ int h_tilable(hfield *h, int f); /* 1 if HF tiles seamlessly */
 hfield *h_zero(int xsize, int ysize);    /* create a new blank HF */
 hfield *h_const(int xsize, int ysize, D value);  /* create a new constant HF */
 
+/* --- sat.cc: box filters ---------------------------------- */
+hfield *h_boxblur(hfield *h0, int r);	/* mean of the box of radius r */
+hfield *h_localvar(hfield *h0, int r);	/* variance in the box of radius r */
+hfield *h_localmin(hfield *h0, int r, int max); /* min or max in the box */
+
+/* --- blur.cc: gaussian blurs ------------------------------ */
+hfield *h_gaussblur(hfield *h0, D sigma);	/* separable convolution */
+hfield *h_iirblur(hfield *h0, D sigma);	/* recursive, any sigma at one cost */
+
+/* --- poisson.cc ------------------------------------------- */
+int p_integrate(PTYPE *h, const PTYPE *gx, const PTYPE *gy, int xsize, int ysize,
+				int wrap);		/* least squares surface of a gradient */
+
 /* ----- cplx.c functions --------------------------------- */
 hfield *c_swap(hfield *hfin); /* swap complex and real parts of matrix */
 hfield *c_join(hfield *hfr, hfield *hfi); /* make complex from real & imag parts of matrix */
@@ -113,17 +194,24 @@ int c_split(hfield *hfc, hfield **hfr, hfield **hfi);  /* divide complex into re
 hfield *c_real(hfield *hf);  /* take real part of array */
 hfield *c_mag(hfield *hfc);		/* take magnitude of complex matrix */
 hfield *c_diff(hfield *hf); /* make complex from x & y slope of matrix */
+hfield *c_int(hfield *hf, const char *method); /* real mx from x & y slope */
 hfield *c_convert(hfield *hfc, int dir);	/* convert complex matrix Rect <-> Polar */
+hfield *c_expand(hfield *hfh);	/* full complex matrix from half spectrum */
 
 
 /* --- rand.c --------------------------------------------------- */
 float ran1(void);		   /* return a single [0..1] float random # */
 void seed_ran1(int seed);		/* use a single integer seed value */
+struct hf_rng { unsigned long long s; };	/* per-thread generator state */
+void rng_seed(hf_rng *r, int seed, U stream); /* independent stream of seed */
+float rng_float(hf_rng *r);		/* [0..1) float random # from r */
 
 /* --- ops.c --------------------------------------------------- */
 hfield *gforge(int size, float h); /* generate terrain */
 hfield *fillarray(int xsize, int ysize, float h); /* gen 1/f noise */
+hfield *fillarray_half(int xsize, int ysize, float h); /* same, half spectrum */
 hfield *h_fft(hfield *hf, int dir, D scaling); /* complex FFT / IFFT routine */
+hfield *h_rfft(hfield *hf, int dir, D scaling); /* real <-> half spectrum FFT */
 hfield *gen_rand(int xsize, int ysize); /* generate random array */
 void initgauss(void); /* initialize rand #/gauss gen */
 double gauss(void); /* return gaussian rand# */
@@ -131,6 +219,8 @@ double gaussn(void); /* returns gaussian dist. rand # between 0 and 1 */
 hfield *h_fourfilt(hfield *hf, D center, D Q, const char *f_type); /* filter real & imag. matrix */
 void f_filter(PTYPE *real, PTYPE *imag, int xsize, int ysize, 
 	      double center, double Q, int f_type);
+void f_filter_half(PTYPE *real, PTYPE *imag, int ld, int xsize, int ysize,
+		   double center, double Q, int f_type);
 hfield *h_realfilt(hfield *hf, D a1, D a2, const char *f_type); /* filter a real matrix */
 
 hfield *yslope(hfield *hfin, D yfrac, D y_sfac, D slope_exp);
@@ -160,7 +250,10 @@ int distribute_craters(PTYPE *real, PTYPE *imag, int xsize, int ysize,
 
 /* ------- erode.c --------------------------------- */
 hfield *h_fillb(hfield *h1, int imax, D rate);  /* fill basin imax times */
+hfield *h_floodfill(hfield *h1, D rate, int eps); /* fill all basins at once */
 hfield *h_find_ua(hfield *h1);                /* find uphill area */
+hfield *h_erode(hfield *h1, int iter, D dt, D k, D talus, D dep); /* fluvial+thermal erosion */
+hfield *h_droplets(hfield *h1, int n, D inertia, D capacity, D evap); /* rain drop erosion */
 
 /* ------ hcon.h -----------------------------------   jpb 7/15/95 */
 
@@ -0,0 +1,239 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Pixel buffers. Every buffer has a small header in front of it with a
+ * reference count, so that several hfields can share one buffer until
+ * one of them is modified (see h_dup and h_own in hf-hl.cc).
+ *
+ * Buffer sizes are rounded up to size classes, four per power of two.
+ * Freed buffers are kept in per-class free lists (up to HF_PARAMS.pool
+ * megabytes) and handed out again to the next request of the same
+ * class, so that a chain of operators on equally sized images doesn't
+ * go through mmap/munmap and page faults for every intermediate result.
+ * Buffers of HPAGE bytes or more are mapped directly, aligned to HPAGE
+ * and marked for transparent huge pages where the system supports it.
+ * Freshly mapped memory is known to be zero, so h_alloc(n, TRUE) only
+ * clears recycled buffers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "hf-hl.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define HDR		64				/* header size; keeps pixels cache-line aligned */
+#define HPAGE	(2UL << 20)		/* huge page size; larger buffers are mapped */
+#define NCLASS	(4*64)
+
+struct hf_buf {
+	size_t size;				/* bytes in the block, header included */
+	int refs;					/* hfields using the buffer */
+	int fresh;					/* not used yet, pixels are all zero */
+	int mapped;					/* from mmap, else from posix_memalign */
+	hf_buf *next;				/* in free list */
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* protects below */
+static hf_buf *pool[NCLASS];
+static size_t pooled;			/* bytes in the free lists */
+
+#define BUF(a) ((hf_buf*)((char*)(a) - HDR))
+#define PIX(b) ((PTYPE*)((char*)(b) + HDR))
+
+static int ilog2(size_t n)
+{
+	int k = 0;
+
+	while(n >>= 1)
+		k++;
+	return k;
+}
+
+/* class of a block of n bytes; the largest class not above n */
+static int cls(size_t n)
+{
+	int k = ilog2(n);
+
+	return 4*k + (k < 2 ? 0 : (int)(n >> (k-2)) & 3);
+}
+
+/* block size for n bytes: the smallest class size not below n */
+static size_t csize(size_t n)
+{
+	int k = ilog2(n);
+	size_t step = k < 8 ? 64 : (size_t)1 << (k-2);
+
+	n = (n + step-1) & ~(step-1);
+	if(n >= HPAGE)				/* lands on a class size again */
+		n = (n + HPAGE-1) & ~(HPAGE-1);
+	return n;
+}
+
+static hf_buf *map(size_t size)
+{
+	char *p, *q;
+	hf_buf *b;
+
+	if(size < HPAGE) {
+		if(posix_memalign((void**)&b, HDR, size))
+			return NULL;
+		b->mapped = FALSE;
+	} else {					/* map more and trim to align */
+		p = (char*)mmap(NULL, size + HPAGE, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p == (char*)MAP_FAILED)
+			return NULL;
+		q = (char*)(((size_t)p + HPAGE-1) & ~(HPAGE-1));
+		if(q > p)
+			munmap(p, q-p);
+		if(p + HPAGE > q)
+			munmap(q + size, p + HPAGE - q);
+#ifdef MADV_HUGEPAGE
+		madvise(q, size, MADV_HUGEPAGE);
+#endif
+		b = (hf_buf*)q;
+		b->mapped = TRUE;
+	}
+	b->size = size;
+	b->fresh = b->mapped;
+	return b;
+}
+
+static void unmap(hf_buf *b)
+{
+	if(b->mapped)
+		munmap(b, b->size);
+	else
+		free(b);
+}
+
+/**
+   Allocate a buffer of n pixels with a reference count of 1. The pixels
+   are cleared only if zero is TRUE; pass FALSE when all of them are
+   about to be overwritten anyway.
+*/
+PTYPE *h_alloc(size_t n, int zero)
+{
+	size_t size = csize(n*sizeof(PTYPE) + HDR);
+	int c = cls(size);
+	hf_buf *b;
+
+	pthread_mutex_lock(&lock);
+	if((b = pool[c])) {
+		pool[c] = b->next;
+		pooled -= b->size;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if(!b && !(b = map(size)))
+		return NULL;
+	if(zero && !b->fresh)
+		memset(PIX(b), 0, b->size - HDR);
+	b->fresh = FALSE;
+	b->refs = 1;
+	return PIX(b);
+}
+
+/**
+   Shrink buffer a to n pixels. Pages beyond the new size are returned
+   to the system. The buffer must not be shared.
+*/
+PTYPE *h_shrink(PTYPE *a, size_t n)
+{
+	hf_buf *b = BUF(a);
+	size_t size = n*sizeof(PTYPE) + HDR;
+
+	if(b->mapped) {
+		size = (size + HPAGE-1) & ~(HPAGE-1);
+		if(size < b->size) {
+			munmap((char*)b + size, b->size - size);
+			b->size = size;
+		}
+	}
+	return a;
+}
+
+/**
+   Add a reference to buffer a.
+*/
+void h_ref(PTYPE *a)
+{
+	__sync_fetch_and_add(&BUF(a)->refs, 1);
+}
+
+/**
+   TRUE if buffer a is used by more than one hfield.
+*/
+int h_shared(const PTYPE *a)
+{
+	return BUF(a)->refs > 1;
+}
+
+/**
+   Drop a reference to buffer a. The last reference puts the buffer into
+   the pool, or returns it to the system if the pool is full.
+*/
+void h_free(PTYPE *a)
+{
+	hf_buf *b;
+	int c;
+
+	if(!a || __sync_sub_and_fetch(&BUF(a)->refs, 1) > 0)
+		return;
+	b = BUF(a);
+	c = cls(b->size);
+
+	pthread_mutex_lock(&lock);
+	if(pooled + b->size <= (size_t)HF_PARAMS.pool << 20) {
+		b->next = pool[c];
+		pool[c] = b;
+		pooled += b->size;
+		b = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if(b)
+		unmap(b);
+}
+
+/**
+   Return all pooled buffers to the system.
+*/
+void h_trim(void)
+{
+	hf_buf *b;
+	int c;
+
+	pthread_mutex_lock(&lock);
+	for(c = 0; c < NCLASS; c++)
+		while((b = pool[c])) {
+			pool[c] = b->next;
+			unmap(b);
+		}
+	pooled = 0;
+	pthread_mutex_unlock(&lock);
+}
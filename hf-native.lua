@@ -56,6 +56,21 @@ M.iminmax = {
 	end
 }
 
+M.stats = {
+	"HF",
+	[[
+Return a table with statistics of the real part, computed in a single
+pass: min, max, mean, var (variance), n (number of pixels that are not
+NaN) and nan (number of NaN pixels). NaNs are left out of the others.
+]],
+	function(hf)
+		assert(hf, "nil image")
+		local s = _hf_stats(hf)
+		return { min = s.min, max = s.max, mean = s.mean, var = s.var,
+				 n = s.n, nan = s.nan }
+	end
+}
+
 M.histeq={
 	"HF [FRAC=1.0]",
 	[[
@@ -197,6 +212,19 @@ dimensions as the matrix currently on the top of the stack.
 	end
 }
 
+M.dup={
+	"HF",
+	[[
+Make a copy of the matrix. The copy shares memory with the original
+until either of them is modified, so this is cheap even for large
+matrices.
+]],
+	function(hf)
+		assert(hf, "nil image")
+		return _hf_dup(hf)
+	end
+}
+
 M.const={
 	"VAL XSIZE [YSIZE=XSIZE]",
 	[[
@@ -338,6 +366,26 @@ Forward (DIR==1) or inverse (DIR==-1) complex FFT.
 	end	
 }
 
+M.rfft={
+	"HF DIR",
+	[[
+Forward (DIR==1) or inverse (DIR==-1) FFT of a real matrix. The
+forward transform returns only the non-redundant half of the
+spectrum, (width/2+1) x height complex values; its 'rwidth' is the
+width of the original matrix. The inverse transform takes such a half
+spectrum and returns a new real matrix. Uses about half the time and
+memory of 'fft'; the frequency-domain filters (ffbp etc.) accept half
+spectra too.
+]],
+	function(hf, dir)
+		assert(hf, "nil image")
+		if (dir ~= 1) and (dir ~= -1) then
+			error("Invalid direction. Must be 1 or -1.")
+		end
+		return _hf_rfft(hf, dir, -2)
+	end
+}
+
 M.rand={
 	"XSIZE [YSIZE=XSIZE]",
 	[[
@@ -454,6 +502,94 @@ See also nsmooth for many sequential "smooth" operations all-in-one.
 	end
 }
 
+M.boxblur={
+	"HF [RADIUS=1]",
+	[[
+Replace each element by the mean of the square of side 2*<radius>+1
+centred on it. The cost per element does not depend on the radius,
+so large radii are as quick as small ones.
+
+At the edges the square wraps around if tile_mode is ON (or AUTO and
+the heightfield tiles); otherwise only the elements inside the
+heightfield are averaged.
+]],
+	function(hf, r)
+		assert(hf, "nil image")
+		return _hf_boxblur(hf, r or 1)
+	end
+}
+
+M.gaussblur={
+	"HF SIGMA",
+	[[
+Gaussian blur with a standard deviation of <sigma> elements, done as
+a horizontal and a vertical pass. The kernel reaches out to gaufac
+(default 4) sigmas, so the time grows with sigma; for wide blurs
+iirblur is faster.
+
+At the edges the heightfield wraps around if tile_mode is ON (or AUTO
+and the heightfield tiles); otherwise the edge elements are repeated.
+]],
+	function(hf, sigma)
+		assert(hf, "nil image")
+		return _hf_gaussblur(hf, sigma)
+	end
+}
+
+M.iirblur={
+	"HF SIGMA",
+	[[
+Approximate gaussian blur using a recursive filter (Young and van
+Vliet), which takes the same time per element for any <sigma>. It is
+close to gaussblur, with slightly longer tails; for sigma below 0.5
+gaussblur is used. Edges are handled as in gaussblur.
+]],
+	function(hf, sigma)
+		assert(hf, "nil image")
+		return _hf_iirblur(hf, sigma)
+	end
+}
+
+M.localvar={
+	"HF [RADIUS=1]",
+	[[
+Variance of the elements in the square of side 2*<radius>+1 centred
+on each element: 0 where the heightfield is flat, large where it is
+rough. Edges are handled as in boxblur. Take the square root for the
+local standard deviation.
+]],
+	function(hf, r)
+		assert(hf, "nil image")
+		return _hf_localvar(hf, r or 1)
+	end
+}
+
+M.localmin={
+	"HF [RADIUS=1]",
+	[[
+Replace each element by the lowest one in the square of side
+2*<radius>+1 centred on it (grey-scale erosion). Like boxblur, the
+time taken does not depend on the radius. The square wraps around the
+edges when tile_mode says the heightfield tiles.
+]],
+	function(hf, r)
+		assert(hf, "nil image")
+		return _hf_localmin(hf, r or 1, 0)
+	end
+}
+
+M.localmax={
+	"HF [RADIUS=1]",
+	[[
+Replace each element by the highest one in the square of side
+2*<radius>+1 centred on it (grey-scale dilation). See localmin.
+]],
+	function(hf, r)
+		assert(hf, "nil image")
+		return _hf_localmin(hf, r or 1, 1)
+	end
+}
+
 M.nsmooth={
 	"HF REPS [MIN=-1E6] [MAX=1E6]",
 	[[
@@ -589,8 +725,7 @@ M.fillbasin={
 Fill in basins by replacing each local minimum with the average
 of the surrounding points. Repeat this procedure <cycles> times.
 This is VERY slow on large HFs, and will not fill large basins
-in any reasonable amount of time (try FILLB at lower resolution
-and then DOUBLE).
+in any reasonable amount of time; use FLOODFILL for that.
 ]],
 	function(hf, cycles)
 		assert(hf, "nil image")
@@ -598,6 +733,22 @@ and then DOUBLE).
 	end
 }
 
+M.floodfill={
+	"HF [RATE=1.0] [EPS=0]",
+	[[
+Fill all basins in a single pass, so that water can flow from every
+point to the edge of the HF (or, if it tiles, to its lowest point).
+Each basin is raised exactly to the level where it spills over.
+<rate> between 0.0 and 1.0 fills the basins only partially. If <eps>
+is nonzero, the filled areas get a tiny slope towards their outlet
+instead of being flat, which FLOW needs to route water across them.
+]],
+	function(hf, rate, eps)
+		assert(hf, "nil image")
+		return _hf_floodfill(hf, rate or 1.0, eps or 0)
+	end
+}
+
 M.flow={
 	"HF",
 	[[
@@ -605,7 +756,7 @@ Calculate flowlines according to slope. Unlike other HF-Lab operators,
 the output is an imagemap rather than a heightfield. Pixel values are 
 proportional to total uphill area (eg, water in a river). Flow lines 
 end at a local minimum (which a typical GForge surface is full of, 
-unless 'fillbasin' has been run for many cycles first).
+unless 'floodfill' has been run on it first).
 ]],
 	function(hf)
 		assert(hf, "nil image")
@@ -613,6 +764,42 @@ unless 'fillbasin' has been run for many cycles first).
 	end
 }
 
+M.erode={
+	"HF [ITER=20] [DT=1.0] [K=0.05] [TALUS=4.0] [DEPOSIT=0.5]",
+	[[
+Erode the HF in place by running <iter> time steps of length <dt>.
+Each step cuts rivers in proportion to the square root of the uphill
+area (as in FLOW) times the local slope, scaled by the erodibility <k>.
+The fraction <deposit> of the cut material settles one pixel
+downstream; the rest is washed away. Slopes steeper than <talus>
+slump down to their neighbours. Slopes are in units of height per
+image width. Use FLOODFILL first, otherwise rivers stop at every
+local minimum.
+]],
+	function(hf, iter, dt, k, talus, deposit)
+		assert(hf, "nil image")
+		return _hf_erode(hf, iter or 20, dt or 1.0, k or 0.05,
+						 talus or 4.0, deposit or 0.5)
+	end
+}
+
+M.droplets={
+	"HF [DROPS=100000] [INERTIA=0.05] [CAPACITY=4.0] [EVAPORATION=0.02]",
+	[[
+Erode the HF in place by letting <drops> rain drops run down it. A
+drop keeps <inertia> (0 to 1) of its direction on every step, picks
+up sediment while it carries less than <capacity> times its speed,
+water and slope, and drops it when it slows down or runs into a pit.
+<evaporation> of its water is lost on every step. The drops start at
+points chosen from PARAMS.rnd_seed, like other random operators.
+]],
+	function(hf, drops, inertia, capacity, evap)
+		assert(hf, "nil image")
+		return _hf_droplets(hf, drops or 100000, inertia or 0.05,
+							capacity or 4.0, evap or 0.02)
+	end
+}
+
 M.bloom={
 	"HFX HFY [SCALE=1.0] [XCENT=0.5] [YCENT=XCENT]",
 	[[
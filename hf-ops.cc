@@ -9,6 +9,8 @@
 #include <time.h>
 #include "hf-hl.h"
 #include "hf-fftn.h"
+#include "hf-par.h"
+#include "hf-tile.h"
 
 #define BANDPASS 1		 /* frequency-domain (fourier) filter types */
 #define BANDREJECT -1
@@ -19,46 +21,58 @@
 static double arand, gaussadd, gaussfac; /* Gaussian random parameters */
 static char rcsid[] UNUSED = "$Id: hf-ops.cc,v 1.1.2.3 2004/01/08 16:30:44 zvrba Exp $";
 
+static void fill_half(PTYPE *real, PTYPE *imag, int ld, int nx, int ny, float h);
+
 /* --------------------------------------------------- */
 
 /* smooth(f) -- smooth matrix by replacing each HF element with average of
 	    its neighbors.  f=0: no smoothing. f=1.0 : full smoothing.
 */
 
+struct smooth_tiles : public hf_tiles {
+	PTYPE *h1;
+	int xsize;					/* for El */
+	D frac;
+
+	smooth_tiles(PTYPE *a1, int x, D f) : h1(a1), xsize(x), frac(f) { }
+	void run(hf_tile &t) {
+		int x,y;
+		double tmp, orig;
+
+		for(y=0;y<t.h;y++) {
+			for (x=0;x<t.w;x++) {
+				orig = Tl(t,x,y);
+				tmp = Tl(t,x-1,y) + Tl(t,x,y-1)+
+					Tl(t,x+1,y) + Tl(t,x,y+1);
+
+				tmp /= 4;         /* compute average of neighbors */
+				tmp = orig + frac*(tmp-orig);
+				El(h1,t.x0+x,t.y0+y) = tmp;
+			}
+		}
+	}
+};
+
 hfield *smooth(hfield *h0, D frac)
 {
-	int x,y;
 	int xsize,ysize;
-	double tmp, orig;
 	hfield *h1;
 	int wrap;
 
+	h_sync(h0);
+
 	if(h0->c) fprintf(stderr, "WARNING: smooth: smoothing real part only.\n");
 	xsize = h0->xsize;
 	ysize = h0->ysize;
 	wrap = h_tilable(h0,0);           /* if image is tilable or not */
   
-	if(h0->c) {
-		if(!(h1 = h_newc(xsize,ysize))) return NULL;
-	} else {
-		if(!(h1 = h_newr(xsize,ysize))) return NULL;
-	}
+	/* imag. part stays zero */
+	if(!(h1 = h_new(xsize,ysize,h0->c,h0->c))) return NULL;
 
-	for(y=0;y<ysize;y++) {
-		for (x=0;x<xsize;x++) {
-			orig = El(h0->a,x,y);
-			if (wrap) tmp = Elmod(h0->a,x-1,y) + Elmod(h0->a,x,y-1)+
-						  Elmod(h0->a,x+1,y) + Elmod(h0->a,x,y+1);
-			else      tmp = Elclip(h0->a,x-1,y) + Elclip(h0->a,x,y-1)+
-						  Elclip(h0->a,x+1,y) + Elclip(h0->a,x,y+1);
-
-			tmp /= 4;         /* compute average of neighbors */
-			tmp = orig + frac*(tmp-orig);
-			El(h1->a,x,y) = tmp;
-		}
-	}
+	smooth_tiles sm(h1->a, xsize, frac);
+	h_partiles(sm, h0->a, xsize, ysize, 1, wrap);
 
-	h_minmax(h1);
+	h_dirty(h1);
 	return h1;
 }
 
@@ -69,7 +83,7 @@ hfield *gen_rand(int xsize, int ysize)
 	register PTYPE *hf;
 	D hmin,hmax,tmp;
  
-	if(!(h1 = h_newr(xsize,ysize))) return NULL;
+	if(!(h1 = h_new(xsize,ysize,FALSE,FALSE))) return NULL;
 	hf = h1->a;
 
 	initgauss(); 
@@ -84,8 +98,7 @@ hfield *gen_rand(int xsize, int ysize)
 			El(hf,x,y) = tmp;
 		}
 	}
-	h1->min = hmin;
-	h1->max = hmax;
+	h_setminmax(h1, hmin, hmax);
 
 	return h1;
 }
@@ -102,11 +115,18 @@ hfield *h_fft(hfield *hf, int dir, D scaling)
 {
 	int dim[2];           /* fft dimensions */
 	PTYPE *hf0, *hf1;
+
+	h_sync(hf);
+	h_own(hf);
  
 	if(!hf->c) {
 		fprintf(stderr, "ERROR: fft: complex matrix is required.\n");
 		return NULL;
 	}
+	if(hf->rxsize) {
+		fprintf(stderr, "ERROR: fft: half spectrum; use rfft.\n");
+		return NULL;
+	}
 
 	hf0 = hf->a;
 	hf1 = &(hf->a[hf->xsize * hf->ysize]); /* starting point of imag. matrix */
@@ -117,13 +137,70 @@ hfield *h_fft(hfield *hf, int dir, D scaling)
 	/* if scaling = -1 norm by dimension, scaling < -1 norm by sqrt(dim) */
 
 	fftnf(2, dim, hf0, hf1, dir, scaling); 
-	h_minmax(hf);
+	h_dirty(hf);
 	return hf;
 }
 
+/* h_rfft(dir, scal)  -- FFT of a real matrix; as h_fft, but a new matrix is
+ *                 returned. dir = +1  real -> half spectrum (see h_newh)
+ *                       -1  half spectrum -> real
+ */
+
+hfield *h_rfft(hfield *hf, int dir, D scaling)
+{
+	int nx, ny, hw;
+	PTYPE *buf;
+	hfield *ret;
+	size_t y;
+
+	h_sync(hf);
+
+	nx = hf->xsize;
+	ny = hf->ysize;
+	if(dir > 0) {
+		if(hf->c) {
+			fprintf(stderr, "ERROR: rfft: real matrix is required.\n");
+			return NULL;
+		}
+		if(!(ret = h_newh(nx, ny))) return NULL;
+		hw = ret->xsize;
+		if(fftrf(nx, ny, hf->a, nx, ret->a, ret->a + (size_t)hw*ny, hw,
+				 dir, scaling)) {
+			h_delete(ret);
+			return NULL;
+		}
+		h_dirty(ret);
+		return ret;
+	}
+
+	if(!hf->rxsize) {
+		fprintf(stderr, "ERROR: rfft: half spectrum is required.\n");
+		return NULL;
+	}
+	nx = hf->rxsize;
+	hw = hf->xsize;
+	if(!(buf = h_alloc((size_t)2*hw*ny, FALSE))) {
+		perror("ERROR: rfft: malloc");
+		return NULL;
+	}
+	for(y = 0; y < (size_t)ny; y++) {	/* interleave rows; transform in place */
+		memcpy(buf + 2*hw*y, hf->a + hw*y, hw*sizeof(PTYPE));
+		memcpy(buf + 2*hw*y + hw, hf->a + (size_t)hw*ny + hw*y, hw*sizeof(PTYPE));
+	}
+	if(fftcrf(nx, ny, buf, buf + hw, 2*hw, buf, 2*hw, dir, scaling)) {
+		h_free(buf);
+		return NULL;
+	}
+	if(!(ret = h_packr(buf, nx, ny, 2*hw))) return NULL;
+	h_dirty(ret);
+	return ret;
+}
+
 hfield *gforge(int size, float h)
 {
 	hfield *ret;
+	PTYPE *a;
+	int hw;
 
 	if(size<3) {
 		fprintf(stderr, "ERROR: gforge: minimum array size is 3.\n");
@@ -134,34 +211,46 @@ hfield *gforge(int size, float h)
 		return NULL;
 	}
 
-	if(!(ret = fillarray(size,size,3.0-h))) { /* generate complex array */
+	/* half spectrum with interleaved real & imag. rows, so that the
+	   inverse fft can overwrite it with the real result */
+	hw = size/2+1;
+	if(!(a = h_alloc((size_t)2*hw*size, TRUE))) {
+		perror("ERROR: gforge: malloc");
 		return NULL;
 	}
-
-	h_fft(ret, -1, 1.0);		/* take inverse fft */
-	c_real(ret);				/* separate real & imag. parts */
+	fill_half(a, a+hw, 2*hw, size, size, 3.0-h);
+	fftcrf(size, size, a, a+hw, 2*hw, a, 2*hw, -1, 1.0); /* take inverse fft */
+	if(!(ret = h_packr(a, size, size, 2*hw))) return NULL;
+	h_dirty(ret);
 	norm(ret, 0, 1);			/* normalize to 0..1 */
 	return ret;
 }
 
-/* fill array with 1/f gaussian noise */
-hfield *fillarray(int xsize, int ysize, float h)
+/* store v at frequency x,y of a half spectrum, if it is in there */
+static inline void put_half(PTYPE *real, PTYPE *imag, int ld, int nx, int ny,
+							int x, int y, double re, double im)
 {
-	hfield *h1;
-	int x,y, k, i0, j0, rank, nx, ny, xcent, ycent, rankmax;
-	double rad, phase, rcos, rsin, scale;
-	PTYPE *real, *imag;
-
-	if(!(h1 = h_newc(xsize,ysize))) return NULL;
-
-	nx = xsize; ny = ysize;
-	real = h1->a;
-	imag = &(h1->a[xsize*ysize]);
+	x = (x + nx) % nx;
+	y = (y + ny) % ny;
+	if (x <= nx/2) {
+		real[y*(size_t)ld + x] = re;
+		imag[y*(size_t)ld + x] = im;
+	}
+}
 
-	/* printf("filling %d x %d HF\n",xsize,ysize); */
+/*
+  Fill the half spectrum real, imag (rows ld apart) of an nx*ny matrix
+  with 1/f gaussian noise. Values are drawn in the same order as they
+  always were, but each one is stored together with its conjugate at
+  -x,-y so that the inverse fft is real.
+*/
+static void fill_half(PTYPE *real, PTYPE *imag, int ld, int nx, int ny, float h)
+{
+	int x,y, k, q, rank, xcent, ycent, rankmax;
+	double rad, phase, rcos, rsin, scale;
 
-	xcent = (int)(xsize / 2.0 - 0.5);  /* center dimensions of array */
-	ycent = (int)(ysize / 2.0 - 0.5);
+	xcent = (int)(nx / 2.0 - 0.5);  /* center dimensions of array */
+	ycent = (int)(ny / 2.0 - 0.5);
 	rankmax = MIN(xcent,ycent);
 
     /* fill in mx. in order of radius, so we can generate higher resolutions
@@ -172,66 +261,54 @@ hfield *fillarray(int xsize, int ysize, float h)
     scale = 1.0;
 
     for (rank = 0; rank <= rankmax; rank++) {
-		/* fill quadrants 2 and 4  */
-		for (k=0;k<=rank;k++) {
-			x = k; y = rank;
-			phase = 2 * M_PI * ((ran1() * 0x7FFF) / arand);
-			if ((x == 0) && (y == 0)) rad = 0; 
-			else rad = pow((double) (x*x + y*y), -(h+1) / 2) * gauss();
-			rcos = rad * cos(phase)*scale; rsin = rad * sin(phase)*scale;
-			El(real, x, y) = rcos; 
-			El(imag, x, y) = rsin;
-			if (!((x == 0) && (y == 0))) { 
-				i0 = nx-x-1; j0 = ny-y-1;
-				El(real, i0,j0) = rcos;
-				El(imag, i0,j0) = rsin;
-			}
-
-			x = rank; y = k;
-			phase = 2 * M_PI * ((ran1() * 0x7FFF) / arand);
-			if ((x == 0) && (y == 0)) rad = 0; 
-			else rad = pow((double) (x*x + y*y), -(h+1) / 2) * gauss();
-			rcos = rad * cos(phase)*scale; rsin = rad * sin(phase)*scale;
-			El(real, x, y) = rcos;
-			El(imag, x, y) = rsin;
-			if (!((x == 0) && (y == 0))) { 
-				i0 = nx-x-1; j0 = ny-y-1;
-				El(real, i0,j0) = rcos;
-				El(imag, i0,j0) = rsin;
-			}
-		} /* end for k */
-    
-		/* now handle quadrants 1 and 3 */
-		for (k=0;k<=rank;k++) {
-			x = k; y = rank;
-			phase = 2 * M_PI * ((ran1() * 0x7FFF) / arand);
-			if ((x == 0) && (y == 0)) rad = 0; 
-			else rad = pow((double) (x*x + y*y), -(h+1) / 2) * gauss();
-			rcos = rad * cos(phase)*scale; 
-			rsin = rad * sin(phase)*scale;
-			El(real, x, ny-y-1) = rcos; 
-			El(imag, x, ny-y-1) = rsin;
-			El(real, nx-x-1, y) = rcos;
-			El(imag, nx-x-1, y) = rsin;
-       
-			x = rank; y = k;
-			phase = 2 * M_PI * ((ran1() * 0x7FFF) / arand);
-			if ((x == 0) && (y == 0)) rad = 0; 
-			else rad = pow((double) (x*x + y*y), -(h+1) / 2) * gauss();
-			rcos = rad * cos(phase)*scale; rsin = rad * sin(phase)*scale;
-			El(real, x, ny-y-1) = rcos; 
-			El(imag, x, ny-y-1) = rsin;
-			El(real, nx-x-1, y) = rcos;
-			El(imag, nx-x-1, y) = rsin;
-      
-		} /* end for k */
+		/* quadrants 2 and 4 (q = 1), then quadrants 1 and 3 (q = -1) */
+		for (q = 1; q >= -1; q -= 2) {
+			for (k=0;k<=rank;k++) {
+				x = k; y = rank;
+				phase = 2 * M_PI * ((ran1() * 0x7FFF) / arand);
+				if ((x == 0) && (y == 0)) rad = 0; 
+				else rad = pow((double) (x*x + y*y), -(h+1) / 2) * gauss();
+				rcos = rad * cos(phase)*scale; rsin = rad * sin(phase)*scale;
+				put_half(real, imag, ld, nx, ny, x, q*y, rcos, rsin);
+				put_half(real, imag, ld, nx, ny, -x, -q*y, rcos, -rsin);
+
+				x = rank; y = k;
+				phase = 2 * M_PI * ((ran1() * 0x7FFF) / arand);
+				if ((x == 0) && (y == 0)) rad = 0; 
+				else rad = pow((double) (x*x + y*y), -(h+1) / 2) * gauss();
+				rcos = rad * cos(phase)*scale; rsin = rad * sin(phase)*scale;
+				put_half(real, imag, ld, nx, ny, x, q*y, rcos, rsin);
+				put_half(real, imag, ld, nx, ny, -x, -q*y, rcos, -rsin);
+			} /* end for k */
+		}
     } /* end for rank */
     
-    El(imag, nx / 2, 0) = 0;
-    El(imag, 0, ny / 2) = 0;
-    El(imag, nx / 2, ny / 2) = 0;
- 
-	h_minmax(h1);				/* find limits of real array */
+    if (nx % 2 == 0) imag[nx / 2] = 0;	/* bins that are their own conjugate */
+    if (ny % 2 == 0) imag[(ny / 2)*(size_t)ld] = 0;
+    if (nx % 2 == 0 && ny % 2 == 0) imag[(ny / 2)*(size_t)ld + nx / 2] = 0;
+}
+
+/* fill half spectrum with 1/f gaussian noise */
+hfield *fillarray_half(int xsize, int ysize, float h)
+{
+	hfield *h1;
+	int hw;
+
+	if(!(h1 = h_newh(xsize,ysize))) return NULL;
+	hw = h1->xsize;
+	fill_half(h1->a, h1->a + (size_t)hw*ysize, hw, xsize, ysize, h);
+	h_dirty(h1);
+	return h1;
+}
+
+/* fill array with 1/f gaussian noise */
+hfield *fillarray(int xsize, int ysize, float h)
+{
+	hfield *hh, *h1;
+
+	if(!(hh = fillarray_half(xsize, ysize, h))) return NULL;
+	h1 = c_expand(hh);
+	h_delete(hh);
 	return h1;
 } /* end fillarray() */
 
@@ -280,6 +357,9 @@ hfield *yslope(hfield *hfin, D yfrac, D y_sfac, D slope_exp)
 	PTYPE *hf;
 	PTYPE hmin, hmax;
 
+	h_sync(hfin);
+	h_own(hfin);
+
 	if((yfrac < 0)||(yfrac > 1)) {
 		fprintf(stderr, "ERROR: yslope: frac must be within [0..1].\n");
 		return NULL;
@@ -312,8 +392,7 @@ hfield *yslope(hfield *hfin, D yfrac, D y_sfac, D slope_exp)
 		} /* end for i */
 	} /* end for j */
 
-	hfin->min = hmin;
-	hfin->max = hmax;
+	h_setminmax(hfin, hmin, hmax);
 
 	return hfin;
 }
@@ -329,6 +408,9 @@ hfield *h_gauss(hfield *hfin, D xfrac, D yfrac, D radfac, D hscale)
 	PTYPE hmin, hmax;
 	int tile;
 
+	h_sync(hfin);
+	h_own(hfin);
+
 	if((yfrac < 0) || (yfrac > 1) || (xfrac<0) || (yfrac>1)) {
 		fprintf(stderr, "ERROR: gauss: xfrac, yfrac must be within [0..1].\n");
 		return NULL;
@@ -368,10 +450,9 @@ hfield *h_gauss(hfield *hfin, D xfrac, D yfrac, D radfac, D hscale)
 			if (tmp < hmin) hmin = tmp;
 		} /* end for x */
 	} /* end for y */
-	if (tile) h_minmax(hfin);
+	if (tile) h_dirty(hfin);
 	else {
-		hfin->min = hmin;
-		hfin->max = hmax;
+		h_setminmax(hfin, hmin, hmax);
 	}
 
 	return hfin;
@@ -388,6 +469,9 @@ hfield *h_ring(hfield *hfin, D xfrac, D yfrac, D radfac, D width, D hscale)
 	PTYPE hmin, hmax;
 	int tile;
 
+	h_sync(hfin);
+	h_own(hfin);
+
 	if((yfrac < 0) || (yfrac > 1) || (xfrac<0) || (yfrac>1)) {
 		fprintf(stderr, "ERROR: gauss: xfrac, yfrac must be within [0..1].\n");
 		return NULL;
@@ -424,10 +508,9 @@ hfield *h_ring(hfield *hfin, D xfrac, D yfrac, D radfac, D width, D hscale)
 			if (tmp < hmin) hmin = tmp;
 		} /* end for x */
 	} /* end for y */
-	if (tile) h_minmax(hfin);
+	if (tile) h_dirty(hfin);
 	else {
-		hfin->min = hmin;
-		hfin->max = hmax;
+		h_setminmax(hfin, hmin, hmax);
 	}
 
 	return hfin;
@@ -441,11 +524,14 @@ hfield *h_crater(hfield *h0, int how_many, D ch_scale, D radius, D dfac)
 	int xsize, ysize;
 	int wrap;
 
+	h_sync(h0);
+	h_own(h0);
+
 	xsize = h0->xsize;
 	ysize = h0->ysize;
 	real = h0->a;
 
-	if(!(h1 = h_newr(xsize,ysize))) return NULL;
+	if(!(h1 = h_new(xsize,ysize,FALSE,FALSE))) return NULL;	/* copy of h0 */
 
 	imag = h1->a;
 	wrap = h_tilable(h0, 0);
@@ -455,7 +541,7 @@ hfield *h_crater(hfield *h0, int how_many, D ch_scale, D radius, D dfac)
 					   wrap, ch_scale, radius, dfac);
 
 	h_delete(h1);
-	h_minmax(h0);				/* update min, max values */
+	h_dirty(h0);
 	return h0;
 }
 
@@ -516,6 +602,72 @@ void f_filter(PTYPE *real, PTYPE *imag, int xsize, int ysize,
 
 }
 
+/* filter gain at normalized radius rad; see f_filter() */
+static inline double f_fac(double rad, double center, double Q, int f_type)
+{
+	double fac, p;
+
+	p = 1.0 / pow(Q * center, 2);
+	if (abs(f_type)==1)
+		fac = p / (p + pow((1.0-rad/center),2)) ; /* bandpass/rej. */
+	else
+		fac = 1.0 / (1.0 + pow((rad/center),Q) ); /* lo/hi-pass */
+	if (f_type < 0) fac = (1.0 - fac);  /* invert filter */
+	return fac;
+}
+
+struct filter_half_rows : public hf_rows {
+	PTYPE *real, *imag;
+	int ld, xsize, ysize, f_type;
+	double center, Q, sfac;
+
+	filter_half_rows(PTYPE *r, PTYPE *i, int l, int x, int y, double c,
+					 double q, int t) :
+		real(r), imag(i), ld(l), xsize(x), ysize(y), f_type(t), center(c), Q(q) {
+		sfac = 1.0/sqrt((double)(xsize*xsize/4 + ysize*ysize/4));
+	}
+	void run(U y0, U y1) {
+		int i, j, j0;
+		double fac;
+
+		for (j = y0; j < (int)y1; j++) {
+			j0 = MIN(j, ysize-j);	/* frequency of row j */
+			for (i = 0; i <= xsize / 2; i++) {
+				fac = f_fac(sqrt((double) (i * i + j0 * j0)) * sfac, center, Q, f_type);
+				real[j*(size_t)ld + i] *= fac;
+				imag[j*(size_t)ld + i] *= fac;
+			}
+		}
+	}
+};
+
+/* f_filter_half()  -- as f_filter(), on the half spectrum of a real
+ *                xsize*ysize array (rows of xsize/2+1 values ld apart)
+ */
+
+void f_filter_half(PTYPE *real, PTYPE *imag, int ld, int xsize, int ysize,
+				   double center, double Q, int f_type)
+{
+    if (center == 0.0) center = -0.00001;  /* avoid a singularity */
+
+	filter_half_rows fr(real, imag, ld, xsize, ysize, center, Q, f_type);
+	h_parfor(fr, ysize, xsize/2+1);
+
+    if (xsize % 2 == 0) imag[xsize / 2] = 0;	/* must stay real */
+    if (ysize % 2 == 0) imag[(ysize / 2)*(size_t)ld] = 0;
+    if (xsize % 2 == 0 && ysize % 2 == 0) imag[(ysize / 2)*(size_t)ld + xsize / 2] = 0;
+}
+
+/* filter type from its name */
+static int ff_type(const char *name)
+{
+	if     (strncmp(name, "ffbp", 4)) return BANDPASS;
+	else if(strncmp(name, "ffbr", 4)) return BANDREJECT;
+	else if(strncmp(name, "fflp", 4)) return LOWPASS;
+	else if(strncmp(name, "ffhp", 4)) return HIGHPASS;
+	return 0;
+}
+
 /* h_fourfilt()  -- do filtering on fourier-domain data in real and
  *              imaginary arrays on stack
  *
@@ -528,6 +680,9 @@ hfield *h_fourfilt(hfield *hf, D center, D Q, const char *f_type)
 	int type;					/* filter type */
 	int xsize,ysize;
 	PTYPE *imag, *real;
+
+	h_sync(hf);
+	h_own(hf);
  
 	if(!hf->c) {
 		fprintf(stderr, "ERROR: fourfilt: matrix must be complex.\n");
@@ -539,17 +694,16 @@ hfield *h_fourfilt(hfield *hf, D center, D Q, const char *f_type)
 	real = hf->a;
 	imag = &(hf->a[xsize*ysize]);
 
-	if     (strncmp(f_type, "ffbp", 4)) type = BANDPASS;
-	else if(strncmp(f_type, "ffbr", 4)) type = BANDREJECT;
-	else if(strncmp(f_type, "fflp", 4)) type = LOWPASS;
-	else if(strncmp(f_type, "ffhp", 4)) type = HIGHPASS;
-	else {
+	if(!(type = ff_type(f_type))) {
 		fprintf(stderr, "ERROR: h_fourfilt: unknown filter type %s\n",f_type);
 		return NULL;
 	}
  
-	f_filter(real, imag, xsize, ysize, center, Q, type); /* do filtering */
-	h_minmax(hf);				/* and those of real array */
+	if(hf->rxsize)				/* do filtering */
+		f_filter_half(real, imag, xsize, hf->rxsize, ysize, center, Q, type);
+	else
+		f_filter(real, imag, xsize, ysize, center, Q, type);
+	h_dirty(hf);
 	return hf;
 }
 
@@ -558,6 +712,10 @@ hfield *h_realfilt(hfield *h0, D a1, D a2, const char *f_type)
 {
 	hfield *h1;
 	char fs[6];
+	int xsize, ysize, hw;
+	PTYPE *a;
+
+	h_sync(h0);
  
 	if      (strncmp(f_type,"bp",2)) {
 		strcpy(fs,"ffbp");
@@ -578,13 +736,26 @@ hfield *h_realfilt(hfield *h0, D a1, D a2, const char *f_type)
 	if (a1==-1) a1=0.1;
 	if (a2==0) a2=1;
 
-	if(!(h1 = c_swap(h0))) return NULL;	/* make matrix complex */
-	c_swap(h1);
+	if(h0->c) {					/* complex: filter the full spectrum */
+		h_fft(h0, 1, 1.0);		/* forward FFT, no rescaling */
+		h_fourfilt(h0, a1, a2, fs);
+		h_fft(h0, -1, -1.0);	/* inverse FFT, rescale by mx. size */
+		return c_real(h0);		/* leave just real part on stack */
+	}
 
-	h_fft(h1, 1, 1.0);			/* forward FFT, no rescaling */
-	h_fourfilt(h1, a1, a2, fs);
-	h_fft(h1, -1, -1.0);		/* inverse FFT, rescale by mx. size */
-	c_real(h1);					/* leave just real part on stack */
+	/* real: half spectrum in interleaved rows, transformed in place */
+	xsize = h0->xsize;
+	ysize = h0->ysize;
+	hw = xsize/2+1;
+	if(!(a = h_alloc((size_t)2*hw*ysize, FALSE))) {
+		perror("ERROR: h_realfilt: malloc");
+		return NULL;
+	}
+	fftrf(xsize, ysize, h0->a, xsize, a, a+hw, 2*hw, 1, 1.0); /* no rescaling */
+	f_filter_half(a, a+hw, 2*hw, xsize, ysize, a1, a2, ff_type(fs));
+	fftcrf(xsize, ysize, a, a+hw, 2*hw, a, 2*hw, -1, -1.0); /* rescale by mx. size */
+	if(!(h1 = h_packr(a, xsize, ysize, 2*hw))) return NULL;
+	h_dirty(h1);
 
 	return h1;
 } /* h_realfilt */
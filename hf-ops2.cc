@@ -7,6 +7,9 @@
 #include <math.h>
 #include <string.h>
 #include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-simd.h"
+#include "hf-tile.h"
 
 static char rcsid[] UNUSED = "$Id: hf-ops2.cc,v 1.1.2.2 2003/12/31 15:25:18 zvrba Exp $";
 
@@ -22,6 +25,9 @@ hfield *h_join(hfield *h1, hfield *h2, int f) /* join two HFs joined together 0=
 	int xsize3, ysize3;   /* new HF */
 	hfield *h3;
 
+	h_sync(h1);
+	h_sync(h2);
+
 	if(h1->c || h2->c) {
 		fprintf(stderr, "ERROR: join: matrix complex.\n");
 		return NULL;
@@ -59,7 +65,7 @@ hfield *h_join(hfield *h1, hfield *h2, int f) /* join two HFs joined together 0=
 		}
 	}
 
-	h_minmax(h3);
+	h_dirty(h3);
 	return h3;
 }
 
@@ -73,18 +79,22 @@ hfield *h_join(hfield *h1, hfield *h2, int f) /* join two HFs joined together 0=
 	       matrices.  <f> is local fractal scaling, <f2> is overall
 	       fractal scaling.
  */
+#define T2(x,y) p2[(y)*ld2+(x)]
 hfield *h_double(hfield *h1, D f, D f2) /* double res. with midpoint-disp interpolation */
 {
 	int x,y;
-	int xsize,ysize;
 	int xsize1, ysize1;   /* old1 HF */
 	int xsize2, ysize2;   /* old2 HF */
 	hfield *h2;
 	PTYPE *hf1, *hf2;
+	hf_tile t;            /* hf2 with a border, so no Elmod/Elclip */
+	PTYPE *p2; long ld2;
 	int tile;
 	D sfac;
 	D a,b,c,d;
 
+	h_sync(h1);
+
 	tile = is_tilable(h1, 0);
 
 	hf1 = h1->a;
@@ -103,86 +113,79 @@ hfield *h_double(hfield *h1, D f, D f2) /* double res. with midpoint-disp interp
 	}
 	f2 /= sqrt((D)xsize2*ysize2);  /* normalize to matrix size */
   
-	if(!(h2 = h_newr(xsize2,ysize2))) return NULL;
+	if(!(h2 = h_new(xsize2,ysize2,FALSE,FALSE))) return NULL;
 	hf2 = h2->a; 
+	if(!h_pad(&t, NULL, xsize2, ysize2, 1, tile)) {
+		h_delete(h2);
+		return NULL;
+	}
 
 	for (y=0;y<ysize1;y++) {      /* copy over initial values */
 		for (x=0;x<xsize1;x++) {
-			El2(hf2,x*2,y*2) = El1(hf1,x,y);
+			Tl(t,x*2,y*2) = El1(hf1,x,y);
 		}
 	}
 	if (!tile) {                  /* fill in edges */
 		for (y=1;y<ysize2;y+=2) {
-			El2(hf2,0,y)=El2(hf2,0,y-1);
-			El2(hf2,xsize2-1,y)=El2(hf2,xsize2-1,y-1);
+			Tl(t,0,y)=Tl(t,0,y-1);
+			Tl(t,xsize2-1,y)=Tl(t,xsize2-1,y-1);
 		}
 		for (x=1;x<xsize2;x+=2) {
-			El2(hf2,x,0) = El2(hf2,x-1,0);
-			El2(hf2,x,ysize2-1) = El2(hf2,x-1,ysize2-1);
+			Tl(t,x,0) = Tl(t,x-1,0);
+			Tl(t,x,ysize2-1) = Tl(t,x-1,ysize2-1);
 		}
 	}
 
+	/* every pass reads only pixels set by the previous ones, so the
+	   border is refreshed once before each pass */
 	initgauss();  /* seed rnd#gen, gauss routine */
-	xsize = xsize2;
-	ysize = ysize2;
+	p2 = t.p; ld2 = t.ld;
 
+	h_pad_edges(&t, 1, tile);
 	for (y=1;y<ysize2;y+=2) {      /* tiling and non-tiling interp. */
 		for (x=1;x<xsize2;x+=2) {
-			if (tile) {
-				a = Elmod(hf2,x+1,y+1); b = Elmod(hf2,x-1,y+1);
-				c = Elmod(hf2,x+1,y-1); d = Elmod(hf2,x-1,y-1);
-			} else {
-				a = Elclip(hf2,x+1,y+1); b = Elclip(hf2,x-1,y+1);
-				c = Elclip(hf2,x+1,y-1); d = Elclip(hf2,x-1,y-1);
-			}
+			a = T2(x+1,y+1); b = T2(x-1,y+1);
+			c = T2(x+1,y-1); d = T2(x-1,y-1);
 			sfac = f2+f*(MAX(MAX(a,b),MAX(c,d)) - MIN(MIN(a,b),MIN(c,d)));
-			El2(hf2,x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
+			T2(x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
 		}
 	}
 
+	h_pad_edges(&t, 1, tile);
 	for (y=0;y<ysize2;y+=2) {      
 		for (x=1;x<xsize2;x+=2) {
-			if (tile) {
-				a = Elmod(hf2,x+1,y); b = Elmod(hf2,x-1,y);
-				c = Elmod(hf2,x,y+1); d = Elmod(hf2,x,y-1);
-			} else {
-				a = Elclip(hf2,x+1,y); b = Elclip(hf2,x-1,y);
-				c = Elclip(hf2,x,y+1); d = Elclip(hf2,x,y-1);
-			}
+			a = T2(x+1,y); b = T2(x-1,y);
+			c = T2(x,y+1); d = T2(x,y-1);
 			sfac = f2+f*(MAX(MAX(a,b),MAX(c,d)) - MIN(MIN(a,b),MIN(c,d)));
-			El2(hf2,x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
+			T2(x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
 		}
 	}
 
+	h_pad_edges(&t, 1, tile);
 	for (y=1;y<ysize2;y+=2) {      
 		for (x=0;x<xsize2;x+=2) {
-			if (tile) {
-				a = Elmod(hf2,x+1,y); b = Elmod(hf2,x-1,y);
-				c = Elmod(hf2,x,y+1); d = Elmod(hf2,x,y-1);
-			} else {
-				a = Elclip(hf2,x+1,y); b = Elclip(hf2,x-1,y);
-				c = Elclip(hf2,x,y+1); d = Elclip(hf2,x,y-1);
-			}
+			a = T2(x+1,y); b = T2(x-1,y);
+			c = T2(x,y+1); d = T2(x,y-1);
 			sfac = f2+f*(MAX(MAX(a,b),MAX(c,d)) - MIN(MIN(a,b),MIN(c,d)));
-			El2(hf2,x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
+			T2(x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
 		}
 	}
   
+	h_pad_edges(&t, 1, tile);
 	for (y=0;y<ysize2;y+=2) {      /* backtrack and adjust original data */
 		for (x=0;x<xsize2;x+=2) {
-			if (tile) {
-				a = Elmod(hf2,x+1,y+1); b = Elmod(hf2,x-1,y+1);
-				c = Elmod(hf2,x+1,y-1); d = Elmod(hf2,x-1,y-1);
-			} else {
-				a = Elclip(hf2,x+1,y+1); b = Elclip(hf2,x-1,y+1);
-				c = Elclip(hf2,x+1,y-1); d = Elclip(hf2,x-1,y-1);
-			}
+			a = T2(x+1,y+1); b = T2(x-1,y+1);
+			c = T2(x+1,y-1); d = T2(x-1,y-1);
 			sfac = 0.5*(f2+f*(MAX(MAX(a,b),MAX(c,d)) - MIN(MIN(a,b),MIN(c,d))));
-			El2(hf2,x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
+			T2(x,y) = (a+b+c+d)/4.0 + sfac*(gaussn()-0.5);
 		}
 	}
   
-	h_minmax(h2);
+	for (y=0;y<ysize2;y++)
+		memcpy(&El2(hf2,0,y), &Tl(t,0,y), xsize2*sizeof(PTYPE));
+	h_unpad(&t);
+
+	h_dirty(h2);
 	return h2;
 }
 
@@ -196,6 +199,8 @@ hfield *h_half(hfield *h1) /* halve resolution by averaging groups of four pixel
 	hfield *h2;
 	PTYPE *hf1, *hf2;
 
+	h_sync(h1);
+
 	hf1 = h1->a;
 	xsize1 = h1->xsize;
 	ysize1 = h1->ysize;
@@ -219,69 +224,43 @@ hfield *h_half(hfield *h1) /* halve resolution by averaging groups of four pixel
 		}
 	}
   
-	h_minmax(h2);
+	h_dirty(h2);
 	return h2;
 }
 
 
-hfield *rescale(hfield *h0, int xsize2, int ysize2) /* rescale heightfield */
-{
-	int x,y;
-	int xa,ya,yaa;
-	int xsize, ysize;
-	size_t mem;
-	hfield *h1;
-	PTYPE *lbuf;                   /* one-line buffer */
-	PTYPE t1,t2;                   /* HF values */
+/* rescale one plane (real or imaginary part) */
+struct rescale_rows : public hf_rows {
+	const PTYPE *h0;
+	PTYPE *h1;
+	int xsize, ysize, xsize2;
 	double xsf,ysf;
-	double ifrac;                  /* interpolation fraction */
-
-	xsize = h0->xsize;             /* get X and Y dimensions of this HF */
-	ysize = h0->ysize;
-
-	mem = (size_t) (xsize+1) * sizeof(PTYPE);
-	lbuf = (PTYPE *)malloc(mem);           /* alloc interpolation line buffer */
 
-	if (h0->c) {
-		if(!(h1 = h_newc(xsize2,ysize2))) return NULL;
-	} else {
-		if(!(h1 = h_newr(xsize2,ysize2))) return NULL;
+	rescale_rows(const PTYPE *a0, PTYPE *a1, int x, int y, int x2, int y2) :
+		h0(a0), h1(a1), xsize(x), ysize(y), xsize2(x2) {
+		xsf = (double) xsize / (xsize2);    /* X and Y scale factors */
+		ysf = (double) ysize / (y2);        /* MOD +1 1/15/96 */
 	}
-
-	xsf = (double) xsize / (xsize2);    /* X and Y scale factors */
-	ysf = (double) ysize / (ysize2);    /* MOD +1 1/15/96 */
-
-	for (y=0;y<ysize2;y++) {       /* y = [0  ... ysize2-1 ] */
-		ya = (int)(y * ysf);                /* ya = [0 ... ysize-1 ]  */
-		ifrac = ((double)y * ysf) - ya;     /* ifrac = [0..1] */
-		if (ya < (ysize-1)) yaa = ya+1;
-		else yaa = 0;
-		for (xa=0;xa<xsize;xa++) {
-			t1 = El(h0->a,xa,ya);      /* linear interpolation from t1 to t2 */
-			t2 = El(h0->a,xa,yaa);
-			lbuf[xa] = INTERPOLATE(t1,t2,ifrac);  /* lbuf[i]  i:0..xsize-1 */
+	void run(U y0, U y1) {
+		int x,y;
+		int xa,ya,yaa;
+		PTYPE *lbuf;                   /* one-line buffer */
+		PTYPE t1,t2;                   /* HF values */
+		double ifrac;                  /* interpolation fraction */
+
+		/* alloc interpolation line buffer */
+		if(!(lbuf = (PTYPE *)malloc((size_t) (xsize+1) * sizeof(PTYPE)))) {
+			perror("ERROR: rescale: malloc");
+			return;
 		}
-		lbuf[xsize] = lbuf[0];      /* last element */
-
-		for (x=0;x<xsize2;x++) {
-			xa = (int)(x * xsf); /* xa = [0 ... xsize-1] */
-			ifrac = ((double)x * xsf) - xa;
-			t1 = lbuf[xa];
-			t2 = lbuf[xa+1];
-			El2(h1->a,x,y) = INTERPOLATE(t1,t2,ifrac);
-		}
-
-	}  /* for (y... ) */
- 
-	if (h0->c) {   /* do everything again for complex side */
-		for (y=0;y<ysize2;y++) {       /* y = [0  ... ysize2-1 ] */
+		for (y=y0;y<(int)y1;y++) {       /* y = [0  ... ysize2-1 ] */
 			ya = (int)(y * ysf);                /* ya = [0 ... ysize-1 ]  */
 			ifrac = ((double)y * ysf) - ya;     /* ifrac = [0..1] */
 			if (ya < (ysize-1)) yaa = ya+1;
 			else yaa = 0;
 			for (xa=0;xa<xsize;xa++) {
-				t1 = Im(h0->a,xa,ya);
-				t2 = Im(h0->a,xa,yaa);
+				t1 = El(h0,xa,ya);      /* linear interpolation from t1 to t2 */
+				t2 = El(h0,xa,yaa);
 				lbuf[xa] = INTERPOLATE(t1,t2,ifrac);  /* lbuf[i]  i:0..xsize-1 */
 			}
 			lbuf[xsize] = lbuf[0];      /* last element */
@@ -291,13 +270,34 @@ hfield *rescale(hfield *h0, int xsize2, int ysize2) /* rescale heightfield */
 				ifrac = ((double)x * xsf) - xa;
 				t1 = lbuf[xa];
 				t2 = lbuf[xa+1];
-				Im2(h1->a,x,y) = INTERPOLATE(t1,t2,ifrac);
-			} /* end for x */
-		} /* end for y */
+				El2(h1,x,y) = INTERPOLATE(t1,t2,ifrac);
+			}
+		}  /* for (y... ) */
+		free(lbuf);  /* free line buffer */
+	}
+};
+
+hfield *rescale(hfield *h0, int xsize2, int ysize2) /* rescale heightfield */
+{
+	int xsize, ysize;
+	hfield *h1;
+
+	h_sync(h0);
+
+	xsize = h0->xsize;             /* get X and Y dimensions of this HF */
+	ysize = h0->ysize;
+
+	if(!(h1 = h_new(xsize2,ysize2,h0->c,FALSE))) return NULL;
+
+	rescale_rows re(h0->a, h1->a, xsize, ysize, xsize2, ysize2);
+	h_parfor(re, ysize2, xsize2);
+ 
+	if (h0->c) {   /* do everything again for complex side */
+		rescale_rows im(&Im(h0->a,0,0), &Im2(h1->a,0,0), xsize, ysize, xsize2, ysize2);
+		h_parfor(im, ysize2, xsize2);
 	} /* end if h0->c */
 
-	free(lbuf);  /* free line buffer */
-	h_minmax(h1);
+	h_dirty(h1);
 	return h1;
 }
 
@@ -308,6 +308,8 @@ hfield *h_clip(hfield *h1, int x1, int y1, int x2, int y2)  /* clip out rectangu
 	int x,y;
 	hfield *h2;
 
+	h_sync(h1);
+
 	if(h1->c) {
 		fprintf(stderr, "ERROR: clip: matrix is complex\n");
 		return NULL;
@@ -336,7 +338,7 @@ hfield *h_clip(hfield *h1, int x1, int y1, int x2, int y2)  /* clip out rectangu
 		}
 	}
 
-	h_minmax(h2);
+	h_dirty(h2);
 	return h2;
 }
 
@@ -358,6 +360,9 @@ hfield *h_warp(hfield *h1, hfield *h2, int opn, D xcent, D ycent, D scalefac,int
 	int tile;
 	PTYPE *hf1, *hf2, *hf3;
 
+	h_sync(h1);
+	h_sync(h2);
+
 	hf2 = h2->a;              /* h2: control HF */
 	xsize2 = h2->xsize;
 	ysize2 = h2->ysize;
@@ -428,7 +433,7 @@ hfield *h_warp(hfield *h1, hfield *h2, int opn, D xcent, D ycent, D scalefac,int
 		} /* for x */
 	} /* for y */
 
-	h_minmax(h3);
+	h_dirty(h3);
 	return h3;
 }
 
@@ -470,6 +475,9 @@ hfield *h_cwarp(hfield *h1, hfield *h2, int opn, D scalefac)  /* warp with compl
 	size_t mem;               /* amount of memory to alloc. for interpolation buffers */
 	PTYPE *lbufr, *lbufi;     /* one-line control mx. interpolation buffers */
 
+	h_sync(h1);
+	h_sync(h2);
+
 	hf2 = h2->a;                 /* h2: control HF (complex) */
 	xsize2 = h2->xsize;
 	ysize2 = h2->ysize;
@@ -580,40 +588,59 @@ hfield *h_cwarp(hfield *h1, hfield *h2, int opn, D scalefac)  /* warp with compl
 		} /* for x */
 	} /* for y */
  
-	h_minmax(h3);
+	h_dirty(h3);
 	return h3;
 }
 
+struct zedge_rows : public hf_rows {
+	PTYPE *hf;
+	int xsize;
+	D xcent,ycent;
+	D xsfac, ysfac;
+	D frac, pwr;
+
+	zedge_rows(PTYPE *a, int x, int y, D f, D p) : hf(a), xsize(x), frac(f), pwr(p) {
+		xcent = x/2.0;
+		ycent = y/2.0;
+		ysfac = M_PI/(1.0-frac);
+		xsfac = M_PI/(1.0-frac);
+	}
+	void run(U y0, U y1) {
+		int ix,iy;
+		D fx,fy;
+
+		for (iy=y0;iy<(int)y1;iy++) {
+			fy = ABS((iy-ycent)/ycent);  /* fy on range 0..1 */
+			if (fy > frac) {        /* in active edge region */
+				fy = ((fy-frac)*ysfac);  /* now fy in range 0..pi */
+				fy = 1.0-((1+sin(fy-PID2))/2.0);
+			} else fy = 1.0;
+			for (ix=0;ix<xsize;ix++) {
+				fx = ABS((ix-xcent)/xcent);
+				if (fx > frac) {        /* in active edge region */
+					fx = ((fx-frac)*xsfac);  /* now fx in range 0..pi */
+					fx = 1.0-((1+sin(fx-PID2))/2.0);
+				} else fx = 1.0;
+				El(hf,ix,iy) *= pow(fx*fy,pwr); 
+			} /* for ix */
+		} /* for iy */
+	}
+};
+
 hfield *h_zedge(hfield *hf, D frac, D pwr)        /* set edges of HF to zero */
 {
-	int ix,iy;
-	D fx,fy;
 	int xsize,ysize;
-	D xcent,ycent;
-	D xsfac, ysfac;
 
-	xsize = hf->xsize; xcent = xsize/2.0;
-	ysize = hf->ysize; ycent = ysize/2.0;
-
-	ysfac = M_PI/(1.0-frac);
-	xsfac = M_PI/(1.0-frac);
-	for (iy=0;iy<ysize;iy++) {
-		fy = ABS((iy-ycent)/ycent);  /* fy on range 0..1 */
-		if (fy > frac) {        /* in active edge region */
-			fy = ((fy-frac)*ysfac);  /* now fy in range 0..pi */
-			fy = 1.0-((1+sin(fy-PID2))/2.0);
-		} else fy = 1.0;
-		for (ix=0;ix<xsize;ix++) {
-			fx = ABS((ix-xcent)/xcent);
-			if (fx > frac) {        /* in active edge region */
-				fx = ((fx-frac)*xsfac);  /* now fx in range 0..pi */
-				fx = 1.0-((1+sin(fx-PID2))/2.0);
-			} else fx = 1.0;
-			El(hf->a,ix,iy) *= pow(fx*fy,pwr); 
-		} /* for ix */
-	} /* for iy */
+	h_sync(hf);
+	h_own(hf);
+
+	xsize = hf->xsize;
+	ysize = hf->ysize;
+
+	zedge_rows ze(hf->a, xsize, ysize, frac, pwr);
+	h_parfor(ze, ysize, xsize);
  
-	h_minmax(hf);
+	h_dirty(hf);
 	return hf;
 }
 
@@ -657,42 +684,32 @@ D h_sample(hfield *h0, D fx, D fy)
 }
 #endif
 
-/* smooth input HF h0, returning as h1: don't touch if h0(x,y) > thresh */
-static void h_smoo2(hfield *h1, hfield *h0, int tile, D th1, D th2)
-{
-	int xsize, ysize;
-	int ix, iy;
-	D ht0, ht1=0;
-	D htx,hty,htx1,hty1;   /* values of HF elements on either side of this one */
-  
-	xsize = h0->xsize;
-	ysize = h0->ysize;
-  
-	for (iy = 0;iy<ysize;iy++) {
-		for (ix = 0;ix<xsize;ix++) {
-			ht0 = El(h0->a,ix,iy);
-			if (tile) {
-				htx =  Elmod(h0->a,ix-1,iy); hty= Elmod(h0->a,ix,iy-1);
-				htx1 =  Elmod(h0->a,ix+1,iy); hty1= Elmod(h0->a,ix,iy+1);
-			} else {
-				htx = Elclip(h0->a,ix-1,iy); hty=Elclip(h0->a,ix,iy-1);
-				htx1 = Elclip(h0->a,ix+1,iy); hty1=Elclip(h0->a,ix,iy+1);
-			}
-			if ((ht0 > th1)&&(ht0 < th2)) {  
-				/* smooth those between elevation limits */
-				ht1 = (htx + htx1 + hty + hty1)/4.0;
-			} else ht1 = ht0;
-			El(h1->a,ix,iy) = ht1;
-		} /* for ix */
-	} /* for iy */
-}
+/* smooth input HF h0, returning as h1: only where th1 < h0(x,y) < th2 */
+struct smoo2_sweep : public hf_sweep {
+	D th1, th2;
+
+	smoo2_sweep(D t1, D t2) : th1(t1), th2(t2) { }
+	U run(const hf_tile &src, hf_tile &dst, int x0, int y0, int w, int h) {
+		U n = 0;
+		int y;
+
+		for (y = y0; y < y0+h; y++)
+			n += v_nsmooth(&Tl(src,x0,y), &Tl(src,x0,y-1), &Tl(src,x0,y+1),
+						   &Tl(dst,x0,y), w, th1, th2);
+		return n;
+	}
+};
 
 hfield *h_nsmooth(hfield *h0, int iter, D th1, D th2)  /* slope-dependent smoothing */
 {
 	int tile;
 	int xsize, ysize;
 	hfield *h1;
-	int repcount=0;
+	hf_tile t[2];
+	int n;
+
+	h_sync(h0);
+	h_own(h0);					/* smoothed in place too */
 
 	xsize = h0->xsize;
 	ysize = h0->ysize;
@@ -703,12 +720,25 @@ hfield *h_nsmooth(hfield *h0, int iter, D th1, D th2)  /* slope-dependent smooth
 	tile = h_tilable(h0, 0);  
 
 	if(!(h1 = h_newr(xsize,ysize))) return NULL;
+	if(!h_pad(&t[0], h0->a, xsize, ysize, 1, tile)) {
+		h_delete(h1);
+		return NULL;
+	}
+	if(!h_pad(&t[1], NULL, xsize, ysize, 1, tile)) {
+		h_unpad(&t[0]);
+		h_delete(h1);
+		return NULL;
+	}
+
+	/* iter times h0 -> h1 -> h0; stops early once nothing changes */
+	smoo2_sweep sw(th1, th2);
+	n = h_iterate(sw, &t[0], &t[1], 2*MAX(iter, 1), tile);
+	h_tile_store(&t[n & 1], h0->a, xsize);
+	h_tile_store(&t[(n+1) & 1], h1->a, xsize);
+	h_unpad(&t[0]);
+	h_unpad(&t[1]);
 
-	do {
-		h_smoo2(h1,h0,tile,th1,th2);
-		h_smoo2(h0,h1,tile,th1,th2);
-	} while (++repcount<iter);
-	
-	h_minmax(h1);
+	h_dirty(h0);
+	h_dirty(h1);
 	return h1;
 }
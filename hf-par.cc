@@ -0,0 +1,172 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Thread pool for per-pixel operators. h_parfor() splits the rows of an
+ * image into chunks which are handed out to the workers (and the calling
+ * thread) through a shared counter, so that faster threads take more
+ * chunks. The pool is created on first use and resized when
+ * HF_PARAMS.threads changes. Only one loop runs at a time; h_parfor()
+ * called while another loop is running (e.g. from within run()) just
+ * runs its body serially.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "hf-hl.h"
+#include "hf-par.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define PAR_MINPIX	32768		/* smaller images are processed serially */
+#define PAR_CHUNKS	4			/* chunks per thread */
+#define PAR_MAXTHR	256
+
+static pthread_mutex_t busy = PTHREAD_MUTEX_INITIALIZER; /* one loop at a time */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* protects below */
+static pthread_cond_t start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static pthread_t *workers;
+static int nworkers;
+static int quit;
+static unsigned generation;		/* incremented for every new loop */
+static int running;				/* workers still busy with the loop */
+
+static hf_rows *job;
+static U job_n, job_grain;
+static volatile U job_next;		/* first row of the next free chunk */
+
+static void run_chunks(void)
+{
+	U y0;
+
+	while((y0 = __sync_fetch_and_add(&job_next, job_grain)) < job_n)
+		job->run(y0, MIN(y0+job_grain, job_n));
+}
+
+static void *worker(void *arg)
+{
+	unsigned gen = (unsigned)(size_t)arg;
+
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(gen == generation && !quit)
+			pthread_cond_wait(&start, &lock);
+		if(quit)
+			break;
+		gen = generation;
+		pthread_mutex_unlock(&lock);
+
+		run_chunks();
+
+		pthread_mutex_lock(&lock);
+		if(--running == 0)
+			pthread_cond_signal(&done);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* stop all workers and start n new ones; called with busy held */
+static void resize(int n)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	quit = 1;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+	for(i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	workers = NULL;
+	nworkers = 0;
+	quit = 0;
+
+	if(n <= 0 || !(workers = (pthread_t*)malloc(n * sizeof(pthread_t))))
+		return;
+	for(i = 0; i < n; i++) {
+		if(pthread_create(&workers[i], NULL, worker, (void*)(size_t)generation)) {
+			perror("WARNING: h_parfor: pthread_create");
+			break;
+		}
+	}
+	nworkers = i;
+}
+
+/**
+   Number of threads used by h_parfor: HF_PARAMS.threads, or the number
+   of online processors if it is 0.
+*/
+int h_nthreads(void)
+{
+	long n = HF_PARAMS.threads;
+
+	if(n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		n = 1;
+	return MIN(n, PAR_MAXTHR);
+}
+
+/**
+   Call body.run() for all rows [0, nrows) of an image xsize pixels wide.
+   Returns when all rows have been processed.
+*/
+void h_parfor(hf_rows &body, U nrows, U xsize)
+{
+	int nt = h_nthreads();
+
+	if(nt < 2 || nrows < 2 || (size_t)nrows*xsize < PAR_MINPIX ||
+	   pthread_mutex_trylock(&busy)) {
+		body.run(0, nrows);
+		return;
+	}
+	if(nworkers != nt-1)
+		resize(nt-1);
+	if(!nworkers) {
+		pthread_mutex_unlock(&busy);
+		body.run(0, nrows);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	job = &body;
+	job_n = nrows;
+	job_grain = MAX(1, nrows / ((nworkers+1) * PAR_CHUNKS));
+	job_next = 0;
+	running = nworkers;
+	generation++;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+
+	run_chunks();
+
+	pthread_mutex_lock(&lock);
+	while(running)
+		pthread_cond_wait(&done, &lock);
+	job = NULL;
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&busy);
+}
@@ -0,0 +1,69 @@
+// -*- C++ -*-
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+#ifndef HF_PAR_H__
+#define HF_PAR_H__
+
+#include <pthread.h>
+#include <float.h>
+#include "hf-hl.h"
+
+/**
+   Body of a parallel loop over image rows. run() is called from several
+   threads at once, each time with a different range of rows [y0, y1).
+   Implementations must only write to rows within the range they are
+   given and must not touch the Lua state.
+*/
+struct hf_rows {
+	virtual void run(U y0, U y1) = 0;
+	virtual ~hf_rows() { }
+};
+
+/**
+   Min and max merged from partial results of several threads. Start it
+   with the same values the serial loop would start with, so that the
+   result is identical to the serial one.
+*/
+struct hf_minmax {
+	PTYPE min, max;
+	pthread_mutex_t lock;
+
+	hf_minmax(PTYPE lo = FLT_MAX, PTYPE hi = -FLT_MAX) : min(lo), max(hi) {
+		pthread_mutex_init(&lock, NULL);
+	}
+	~hf_minmax() {
+		pthread_mutex_destroy(&lock);
+	}
+	void merge(PTYPE lo, PTYPE hi) {
+		pthread_mutex_lock(&lock);
+		if(lo < min) min = lo;
+		if(hi > max) max = hi;
+		pthread_mutex_unlock(&lock);
+	}
+};
+
+int h_nthreads(void);
+void h_parfor(hf_rows &body, U nrows, U xsize);
+
+#endif // HF_PAR_H__
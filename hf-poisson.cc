@@ -0,0 +1,387 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Least squares integration of a gradient field: the surface h whose
+ * differences h(x,y)-h(x-1,y) and h(x,y)-h(x,y-1) come closest to gx
+ * and gy. That is the Poisson equation L h = div g, with L the
+ * Laplacian of the pixel grid (each pixel linked to its 4 neighbours,
+ * across the edges too if the image wraps).
+ *
+ * It is solved by conjugate gradients, preconditioned with a multigrid
+ * V-cycle. Each coarser level merges 2x2 blocks of pixels; its
+ * operator is again a grid Laplacian, whose link weights count the
+ * finer links between two blocks (the Galerkin operator for piecewise
+ * constant interpolation). This handles odd sizes and both edge modes
+ * without special cases. Smoothing is damped Jacobi, so every step is
+ * a parallel loop over rows, and dot products are summed per row and
+ * then in order, so the result doesn't depend on the thread count.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hf-hl.h"
+#include "hf-par.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define MG_OMEGA	0.8			/* Jacobi damping */
+#define MG_SWEEPS	2			/* before and after the coarse correction */
+#define MG_TOL		1e-6		/* relative residual to stop at */
+#define MG_MAXIT	200
+
+struct mg_level {
+	int xs, ys;
+	int wrap;
+	PTYPE *wx;			/* weight of link (x-1,y)-(x,y); NULL: 1 or 0 at edge */
+	PTYPE *wy;			/* (x,y-1)-(x,y) */
+	PTYPE *x, *b, *t;	/* solution, right hand side, scratch */
+};
+
+/* weight of the link to the left of / above pixel x, y */
+static inline PTYPE mg_wx(const mg_level *l, int x, int y)
+{
+	if (l->wx) return l->wx[(size_t)y*l->xs + x];
+	return x > 0 || (l->wrap && l->xs > 1);
+}
+
+static inline PTYPE mg_wy(const mg_level *l, int x, int y)
+{
+	if (l->wy) return l->wy[(size_t)y*l->xs + x];
+	return y > 0 || (l->wrap && l->ys > 1);
+}
+
+/* (L v)(x,y) and the diagonal of L there */
+static inline D mg_lap(const mg_level *l, const PTYPE *v, int x, int y, D *diag)
+{
+	int xs = l->xs, ys = l->ys;
+	int xr = x+1 < xs ? x+1 : 0, yd = y+1 < ys ? y+1 : 0;
+	D wl = mg_wx(l, x, y), wr = mg_wx(l, xr, y);
+	D wu = mg_wy(l, x, y), wd = mg_wy(l, x, yd);
+	const PTYPE *row = v + (size_t)y*xs;
+	D s = 0;
+
+	/* a zero weight may stand for a link off the edge; skip the read */
+	if (wl) s += wl * row[x > 0 ? x-1 : xs-1];
+	if (wr) s += wr * row[xr];
+	if (wu) s += wu * v[(size_t)(y > 0 ? y-1 : ys-1)*xs + x];
+	if (wd) s += wd * v[(size_t)yd*xs + x];
+	*diag = wl + wr + wu + wd;
+	return *diag * row[x] - s;
+}
+
+enum { MG_JACOBI, MG_RESID, MG_RESTRICT, MG_PROLONG,
+	   MG_APPLY, MG_UPDATE, MG_DOT, MG_DIR };
+
+/*
+  The steps of the solver, each a loop over the rows of level l (for
+  MG_RESTRICT, of the coarser level c). Steps that take a dot product
+  leave the sum of each row in part[].
+*/
+struct mg_rows : public hf_rows {
+	int op;
+	mg_level *l, *c;
+	const PTYPE *u;
+	PTYPE *v, *w;
+	D a;
+	D *part;
+
+	mg_rows(int o, mg_level *l_) : op(o), l(l_), c(NULL), u(NULL), v(NULL),
+		w(NULL), a(0), part(NULL) { }
+	void run(U y0, U y1) {
+		int xs = l->xs, x, y;
+		D d, s;
+
+		for (y = y0; y < (int)y1; y++) {
+			size_t i = (size_t)y*xs;
+
+			s = 0;
+			switch (op) {
+			case MG_JACOBI:		/* t = x + omega (b - L x) / diag */
+				for (x = 0; x < xs; x++) {
+					D r = l->b[i+x] - mg_lap(l, l->x, x, y, &d);
+					l->t[i+x] = d > 0 ? l->x[i+x] + MG_OMEGA * r / d : 0;
+				}
+				break;
+			case MG_RESID:		/* t = b - L x */
+				for (x = 0; x < xs; x++)
+					l->t[i+x] = l->b[i+x] - mg_lap(l, l->x, x, y, &d);
+				break;
+			case MG_RESTRICT:	/* c->b = sum of t over 2x2 blocks */
+				for (x = 0; x < c->xs; x++) {
+					int fx = 2*x, fy = 2*y;
+
+					s = l->t[(size_t)fy*xs + fx];
+					if (fx+1 < xs) s += l->t[(size_t)fy*xs + fx+1];
+					if (fy+1 < l->ys) {
+						s += l->t[(size_t)(fy+1)*xs + fx];
+						if (fx+1 < xs) s += l->t[(size_t)(fy+1)*xs + fx+1];
+					}
+					c->b[(size_t)y*c->xs + x] = s;
+				}
+				break;
+			case MG_PROLONG:	/* x += c->x of the block */
+				for (x = 0; x < xs; x++)
+					l->x[i+x] += c->x[(size_t)(y/2)*c->xs + x/2];
+				break;
+			case MG_APPLY:		/* w = L u, part = u.w */
+				for (x = 0; x < xs; x++) {
+					w[i+x] = mg_lap(l, u, x, y, &d);
+					s += (D)u[i+x] * w[i+x];
+				}
+				break;
+			case MG_UPDATE:		/* v += a u, w -= a L u (given), part = w.w */
+				for (x = 0; x < xs; x++) {
+					v[i+x] += a * u[i+x];
+					w[i+x] -= a * l->t[i+x];
+					s += (D)w[i+x] * w[i+x];
+				}
+				break;
+			case MG_DOT:		/* part = u.v */
+				for (x = 0; x < xs; x++)
+					s += (D)u[i+x] * v[i+x];
+				break;
+			case MG_DIR:		/* v = u + a v */
+				for (x = 0; x < xs; x++)
+					v[i+x] = u[i+x] + a * v[i+x];
+				break;
+			}
+			if (part) part[y] = s;
+		}
+	}
+};
+
+static void mg_run(mg_rows &r, int ny)
+{
+	h_parfor(r, ny, r.c && r.op == MG_RESTRICT ? 4*r.c->xs : r.l->xs);
+}
+
+/* sum of the rows of a dot product, in order */
+static D mg_sum(const D *part, int n)
+{
+	D s = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		s += part[i];
+	return s;
+}
+
+/* weights of the links between the 2x2 blocks of level f */
+static void mg_coarsen(const mg_level *f, mg_level *c)
+{
+	int x, y, fx, fy;
+
+	for (y = 0; y < c->ys; y++)
+		for (x = 0; x < c->xs; x++) {
+			fx = 2*x; fy = 2*y;
+			PTYPE wx = mg_wx(f, fx, fy), wy = mg_wy(f, fx, fy);
+
+			if (fy+1 < f->ys) wx += mg_wx(f, fx, fy+1);
+			if (fx+1 < f->xs) wy += mg_wy(f, fx+1, fy);
+			/* a block linked to itself adds nothing */
+			c->wx[(size_t)y*c->xs + x] = c->xs > 1 ? wx : 0;
+			c->wy[(size_t)y*c->xs + x] = c->ys > 1 ? wy : 0;
+		}
+}
+
+/* x = approximate solution of L x = b on level l and below */
+static void mg_vcycle(mg_level *lv, int l, int nl)
+{
+	mg_level *f = &lv[l];
+	size_t n = (size_t)f->xs * f->ys;
+	PTYPE *tmp;
+	int i;
+
+	memset(f->x, 0, n * sizeof(PTYPE));
+	if (l == nl-1)				/* one pixel: only the constant, which */
+		return;					/* L can't see */
+
+	mg_rows jac(MG_JACOBI, f);
+	for (i = 0; i < MG_SWEEPS; i++) {
+		mg_run(jac, f->ys);
+		tmp = f->x; f->x = f->t; f->t = tmp;
+	}
+	mg_rows res(MG_RESID, f);
+	mg_run(res, f->ys);
+	mg_rows rs(MG_RESTRICT, f);
+	rs.c = &lv[l+1];
+	mg_run(rs, rs.c->ys);
+
+	mg_vcycle(lv, l+1, nl);
+
+	mg_rows pr(MG_PROLONG, f);
+	pr.c = &lv[l+1];
+	mg_run(pr, f->ys);
+	for (i = 0; i < MG_SWEEPS; i++) {
+		mg_run(jac, f->ys);
+		tmp = f->x; f->x = f->t; f->t = tmp;
+	}
+}
+
+/*
+  Solve L h = b for the xsize x ysize grid; b is overwritten. Level 0
+  borrows h, b and the CG vectors; the coarser ones are allocated in
+  one block. Returns the number of iterations, or -1 if out of memory.
+*/
+static int mg_solve(PTYPE *h, PTYPE *b, int xsize, int ysize, int wrap)
+{
+	mg_level lv[64];
+	int nl, i, xs, ys, it = -1;
+	size_t n = (size_t)xsize*ysize, nc = 0;
+	PTYPE *buf = NULL, *q = NULL, *p = NULL, *z = NULL, *tmp;
+	D *part = NULL, rz, rz1, r0, rr, a;
+
+	/* the levels, down to a single pixel */
+	for (nl = 0, xs = xsize, ys = ysize; ; nl++) {
+		lv[nl].xs = xs; lv[nl].ys = ys;
+		lv[nl].wrap = wrap;
+		if (nl) nc += 5 * (size_t)xs*ys;
+		if (xs == 1 && ys == 1) break;
+		xs = (xs+1)/2; ys = (ys+1)/2;
+	}
+	nl++;
+
+	if (!(part = (D*)malloc(ysize * sizeof(D))) ||
+		!(p = h_alloc(n, FALSE)) || !(q = h_alloc(n, FALSE)) ||
+		!(z = h_alloc(n, FALSE)) || (nc && !(buf = h_alloc(nc, FALSE)))) {
+		fprintf(stderr, "ERROR: cint: out of memory.\n");
+		goto out;
+	}
+	lv[0].wx = lv[0].wy = NULL;
+	lv[0].b = b;				/* preconditioner: z = M b, */
+	lv[0].x = z;				/* the residual is kept in b */
+	lv[0].t = q;
+	for (i = 1, tmp = buf; i < nl; i++) {
+		size_t m = (size_t)lv[i].xs * lv[i].ys;
+
+		lv[i].wx = tmp; lv[i].wy = tmp + m;
+		lv[i].x = tmp + 2*m; lv[i].b = tmp + 3*m; lv[i].t = tmp + 4*m;
+		tmp += 5*m;
+		mg_coarsen(&lv[i-1], &lv[i]);
+	}
+
+	/* conjugate gradients on r = b, starting from h = 0 */
+	memset(h, 0, n * sizeof(PTYPE));
+	{
+		mg_rows dot(MG_DOT, &lv[0]);
+		dot.u = b; dot.v = b; dot.part = part;
+		mg_run(dot, ysize);
+		r0 = sqrt(mg_sum(part, ysize));
+	}
+	mg_vcycle(lv, 0, nl);
+	z = lv[0].x; q = lv[0].t;	/* the sweeps may have swapped them */
+	memcpy(p, z, n * sizeof(PTYPE));
+	{
+		mg_rows dot(MG_DOT, &lv[0]);
+		dot.u = b; dot.v = z; dot.part = part;
+		mg_run(dot, ysize);
+		rz = mg_sum(part, ysize);
+	}
+	for (it = 0; r0 > 0 && it < MG_MAXIT; ) {
+		mg_rows ap(MG_APPLY, &lv[0]);	/* q = L p */
+		ap.u = p; ap.w = q; ap.part = part;
+		mg_run(ap, ysize);
+		if ((a = mg_sum(part, ysize)) <= 0)
+			break;
+		a = rz / a;
+
+		lv[0].t = q;
+		mg_rows up(MG_UPDATE, &lv[0]);	/* h += a p, r -= a q */
+		up.u = p; up.v = h; up.w = b; up.a = a; up.part = part;
+		mg_run(up, ysize);
+		rr = sqrt(mg_sum(part, ysize));
+		if (getenv("MGDBG")) fprintf(stderr, "%d %g\n", it, rr/r0);
+		it++;
+		if (rr <= MG_TOL * r0)
+			break;
+
+		lv[0].x = z; lv[0].t = q;
+		mg_vcycle(lv, 0, nl);
+		z = lv[0].x; q = lv[0].t;
+		mg_rows dot(MG_DOT, &lv[0]);
+		dot.u = b; dot.v = z; dot.part = part;
+		mg_run(dot, ysize);
+		rz1 = mg_sum(part, ysize);
+
+		mg_rows dir(MG_DIR, &lv[0]);	/* p = z + beta p */
+		dir.u = z; dir.v = p; dir.a = rz1 / rz;
+		mg_run(dir, ysize);
+		rz = rz1;
+	}
+
+out:
+	if (buf) h_free(buf);
+	if (z) h_free(z);
+	if (q) h_free(q);
+	if (p) h_free(p);
+	free(part);
+	return it;
+}
+
+/*
+  Least squares surface for the gradient field gx, gy (as c_diff makes
+  them), with h(0,0) = 0. Off the edges the field wraps if wrap, and
+  the differences across the edge are used; else they are left out.
+  Returns FALSE if out of memory.
+*/
+int p_integrate(PTYPE *h, const PTYPE *gx, const PTYPE *gy, int xsize, int ysize,
+				int wrap)
+{
+	mg_level l0;
+	PTYPE *b, h00;
+	size_t n = (size_t)xsize*ysize, i;
+	int x, y, it;
+
+	if (!(b = h_alloc(n, FALSE))) {
+		fprintf(stderr, "ERROR: cint: out of memory.\n");
+		return FALSE;
+	}
+	l0.xs = xsize; l0.ys = ysize; l0.wrap = wrap;
+	l0.wx = l0.wy = NULL;
+
+	/* b = -div g over the links that exist */
+	for (y = 0; y < ysize; y++)
+		for (x = 0; x < xsize; x++) {
+			int xr = x+1 < xsize ? x+1 : 0, yd = y+1 < ysize ? y+1 : 0;
+			D s = 0;
+
+			i = (size_t)y*xsize + x;
+			if (mg_wx(&l0, x, y)) s += gx[i];
+			if (mg_wx(&l0, xr, y)) s -= gx[(size_t)y*xsize + xr];
+			if (mg_wy(&l0, x, y)) s += gy[i];
+			if (mg_wy(&l0, x, yd)) s -= gy[(size_t)yd*xsize + x];
+			b[i] = s;
+		}
+
+	it = mg_solve(h, b, xsize, ysize, wrap);
+	h_free(b);
+	if (it < 0)
+		return FALSE;
+
+	h00 = h[0];
+	for (i = 0; i < n; i++)
+		h[i] -= h00;
+	return TRUE;
+}
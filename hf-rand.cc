@@ -132,3 +132,27 @@ float ran1(void)
 
 	return(uni);            /* return the random # */
 }  /* end ran1() */
+
+/*
+  ran1() keeps its state in statics, so it can't be used from several
+  threads. hf_rng is a SplitMix64 generator whose state is a single
+  word; seeded from a seed and a stream number (e.g. the index of a
+  work item), each stream is independent and gives the same numbers
+  no matter which thread draws them.
+*/
+void rng_seed(hf_rng *r, int seed, U stream)
+{
+	r->s = ((unsigned long long)(unsigned)seed << 32 | stream)
+		* 0x9E3779B97F4A7C15ULL;
+	rng_float(r);				/* mix the seed in */
+}
+
+float rng_float(hf_rng *r)		/* [0..1) */
+{
+	unsigned long long z = (r->s += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return (z >> 40) * (1.0f / 16777216.0f);
+}
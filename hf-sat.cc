@@ -0,0 +1,380 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Summed-area tables (integral images). Built in two parallel passes:
+ * prefix sums along each row, then down each strip of columns. A box
+ * sum or mean of any size then costs four lookups, so operators that
+ * need local means no longer pay for the radius.
+ *
+ * The local min/max operators can't use a table; they use the van
+ * Herk/Gil-Werman running extremum instead, which is likewise O(1) per
+ * pixel whatever the radius: a line is cut into windows-wide blocks,
+ * and the extremum of any window is that of the suffix of one block
+ * and the prefix of the next.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-sat.h"
+#include "hf-tile.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+#define SAT_STRIP	256			/* columns per job of the vertical pass */
+
+struct sat_rows : public hf_rows {
+	hf_sat *t;
+	const PTYPE *a;
+	int xsize;					/* for El */
+	D k;						/* sum (a-k)^2 if sq */
+	int sq;
+
+	sat_rows(hf_sat *t_, const PTYPE *a_, D k_, int sq_) :
+		t(t_), a(a_), xsize(t_->xsize), k(k_), sq(sq_) { }
+	void run(U y0, U y1) {
+		U x, y;
+		D sum, v;
+
+		for (y = y0; y < y1; y++) {
+			D *s = &Sat(*t,0,y+1);
+
+			sum = s[0] = 0;
+			if (sq) {
+				for (x = 0; x < (U)xsize; x++) {
+					v = El(a,x,y) - k;
+					s[x+1] = sum += v*v;
+				}
+			} else {
+				for (x = 0; x < (U)xsize; x++)
+					s[x+1] = sum += El(a,x,y);
+			}
+		}
+	}
+};
+
+struct sat_cols : public hf_rows {
+	hf_sat *t;
+
+	sat_cols(hf_sat *t_) : t(t_) { }
+	void run(U s0, U s1) {
+		U x, x0 = s0*SAT_STRIP, x1 = MIN(s1*SAT_STRIP, (U)t->xsize+1);
+		int y;
+
+		for (y = 2; y <= t->ysize; y++) {
+			D *s = &Sat(*t,0,y), *p = &Sat(*t,0,y-1);
+
+			for (x = x0; x < x1; x++)
+				s[x] += p[x];
+		}
+	}
+};
+
+static int sat_make(hf_sat *t, const PTYPE *a, int xsize, int ysize, D k, int sq)
+{
+	size_t n = (size_t)(xsize+1)*(ysize+1);
+	int x;
+
+	if (!t->s || t->xsize != xsize || t->ysize != ysize) {
+		free(t->s);
+		if (!(t->s = (D*)malloc(n * sizeof(D)))) {
+			fprintf(stderr, "ERROR: sat_build: out of memory.\n");
+			return FALSE;
+		}
+	}
+	t->xsize = xsize;
+	t->ysize = ysize;
+	for (x = 0; x <= xsize; x++)
+		Sat(*t,x,0) = 0;
+
+	sat_rows sr(t, a, k, sq);
+	h_parfor(sr, ysize, xsize);
+	sat_cols sc(t);
+	h_parfor(sc, (xsize+1 + SAT_STRIP-1) / SAT_STRIP, (U)SAT_STRIP*ysize);
+	return TRUE;
+}
+
+/**
+   Build the summed-area table of the xsize x ysize image a into t,
+   reusing its buffer if it was built for an image of the same size.
+   Returns FALSE if out of memory.
+*/
+int sat_build(hf_sat *t, const PTYPE *a, int xsize, int ysize)
+{
+	return sat_make(t, a, xsize, ysize, 0, FALSE);
+}
+
+/**
+   Same for the squares (a-k)^2. With k close to the mean of a, the
+   variance computed from the two tables doesn't lose its precision
+   to the offset of the heights.
+*/
+int sat_build_sq(hf_sat *t, const PTYPE *a, int xsize, int ysize, D k)
+{
+	return sat_make(t, a, xsize, ysize, k, TRUE);
+}
+
+void sat_free(hf_sat *t)
+{
+	free(t->s);
+	t->s = NULL;
+}
+
+/* [i0, i1) wrapped or clipped to [0, n), as at most two ranges in r;
+   returns their number */
+static int sat_span(int i0, int i1, int n, int wrap, int *r)
+{
+	if (!wrap) {
+		r[0] = MAX(i0, 0); r[1] = MIN(i1, n);
+		return r[0] < r[1];
+	}
+	if (i1 - i0 >= n) {
+		r[0] = 0; r[1] = n;
+		return 1;
+	}
+	if (i1 <= i0)
+		return 0;
+	i1 -= i0;					/* length */
+	i0 = ((i0 % n) + n) % n;
+	r[0] = i0; r[1] = MIN(i0 + i1, n);
+	if (i0 + i1 <= n)
+		return 1;
+	r[2] = 0; r[3] = i0 + i1 - n;
+	return 2;
+}
+
+/**
+   Mean of the box [x0, x1) x [y0, y1). The box may reach outside of the
+   image: with wrap it continues on the opposite side, otherwise only
+   the pixels within the image are counted. Returns 0 for an empty box.
+*/
+D sat_mean(const hf_sat *t, int x0, int y0, int x1, int y1, int wrap)
+{
+	int xr[4], yr[4];
+	int nx, ny, i, j;
+	D sum = 0, area = 0;
+
+	nx = sat_span(x0, x1, t->xsize, wrap, xr);
+	ny = sat_span(y0, y1, t->ysize, wrap, yr);
+	for (j = 0; j < ny; j++)
+		for (i = 0; i < nx; i++) {
+			sum += sat_sum(t, xr[2*i], yr[2*j], xr[2*i+1], yr[2*j+1]);
+			area += (D)(xr[2*i+1] - xr[2*i]) * (yr[2*j+1] - yr[2*j]);
+		}
+	return area > 0 ? sum / area : 0;
+}
+
+/* box of radius r around every pixel, from the tables of a and (a-k)^2 */
+struct box_rows : public hf_rows {
+	const hf_sat *t, *t2;		/* t2 is NULL for the mean */
+	PTYPE *out;
+	int xsize, ysize, r, wrap;
+	D k;
+
+	box_rows(const hf_sat *t_, const hf_sat *t2_, PTYPE *o, int r_, int w, D k_) :
+		t(t_), t2(t2_), out(o), xsize(t_->xsize), ysize(t_->ysize), r(r_),
+		wrap(w), k(k_) { }
+	void run(U y0, U y1) {
+		int x, y;
+		D area = (D)(2*r+1)*(2*r+1), m, m2;
+
+		for (y = y0; y < (int)y1; y++) {
+			for (x = 0; x < xsize; x++) {
+				if (x >= r && x+r < xsize && y >= r && y+r < ysize) {
+					m = sat_sum(t, x-r, y-r, x+r+1, y+r+1) / area;
+					m2 = t2 ? sat_sum(t2, x-r, y-r, x+r+1, y+r+1) / area : 0;
+				} else {		/* box reaches over the edge */
+					m = sat_mean(t, x-r, y-r, x+r+1, y+r+1, wrap);
+					m2 = t2 ? sat_mean(t2, x-r, y-r, x+r+1, y+r+1, wrap) : 0;
+				}
+				if (t2) {
+					m -= k;
+					m = MAX(m2 - m*m, 0.0);
+				}
+				El(out,x,y) = m;
+			}
+		}
+	}
+};
+
+/*
+  Mean (var FALSE) or variance (var TRUE) of the (2r+1)x(2r+1) box
+  around each pixel of h0. Off the edges the box wraps if h0 tiles and
+  is cut off otherwise.
+*/
+static hfield *h_boxstat(hfield *h0, int r, int var, const char *name)
+{
+	hfield *h1;
+	hf_sat t = SAT_INIT, t2 = SAT_INIT;
+	int xsize, ysize;
+	D k = 0;
+
+	h_sync(h0);
+
+	if(h0->c) {
+		fprintf(stderr, "ERROR: %s: matrix is complex.\n", name);
+		return NULL;
+	}
+	if(r < 0) {
+		fprintf(stderr, "ERROR: %s: radius must be >= 0.\n", name);
+		return NULL;
+	}
+	xsize = h0->xsize;
+	ysize = h0->ysize;
+	if(!(h1 = h_new(xsize, ysize, FALSE, FALSE))) return NULL;
+
+	if(var) {
+		h_range(h0);
+		k = 0.5*(h0->min + h0->max);
+	}
+	if(!sat_build(&t, h0->a, xsize, ysize) ||
+	   (var && !sat_build_sq(&t2, h0->a, xsize, ysize, k))) {
+		sat_free(&t);
+		h_delete(h1);
+		return NULL;
+	}
+
+	box_rows br(&t, var ? &t2 : NULL, h1->a, r, h_tilable(h0, 0), k);
+	h_parfor(br, ysize, xsize);
+
+	sat_free(&t);
+	sat_free(&t2);
+	h_dirty(h1);
+	return h1;
+}
+
+hfield *h_boxblur(hfield *h0, int r)	/* mean of the box of radius r */
+{
+	return h_boxstat(h0, r, FALSE, "boxblur");
+}
+
+hfield *h_localvar(hfield *h0, int r)	/* variance in the box of radius r */
+{
+	return h_boxstat(h0, r, TRUE, "localvar");
+}
+
+/*
+  Running min (or max) of windows w = 2r+1 wide along a line of n
+  values; in[] has r extra values on either side (wrapped or clamped
+  by the caller). g and h are scratch of n+2r values each.
+*/
+static void herk_line(const PTYPE *in, PTYPE *out, int n, int r, int max,
+					  PTYPE *g, PTYPE *h)
+{
+	int w = 2*r+1, m = n + 2*r, i, j;
+
+	for (i = 0; i < m; i += w) {	/* prefix g, suffix h of each block */
+		int e = MIN(i+w, m);
+
+		g[i] = in[i];
+		for (j = i+1; j < e; j++)
+			g[j] = max ? MAX(g[j-1], in[j]) : MIN(g[j-1], in[j]);
+		h[e-1] = in[e-1];
+		for (j = e-2; j >= i; j--)
+			h[j] = max ? MAX(h[j+1], in[j]) : MIN(h[j+1], in[j]);
+	}
+	for (i = 0; i < n; i++)			/* window [i, i+w) of the padded line */
+		out[i] = max ? MAX(h[i], g[i+w-1]) : MIN(h[i], g[i+w-1]);
+}
+
+/* one pass of the local min/max along rows (cols FALSE) or columns */
+struct herk_rows : public hf_rows {
+	const PTYPE *a;
+	PTYPE *out;
+	int xsize, ysize, r, max, wrap, cols;
+
+	herk_rows(const PTYPE *a_, PTYPE *o, int x, int y, int r_, int m, int w, int c) :
+		a(a_), out(o), xsize(x), ysize(y), r(r_), max(m), wrap(w), cols(c) { }
+	void run(U l0, U l1) {
+		int n = cols ? ysize : xsize;
+		int m = n + 2*r, i;
+		U l;
+		PTYPE *buf;
+
+		if (!(buf = (PTYPE*)malloc(4 * m * sizeof(PTYPE)))) {
+			fprintf(stderr, "ERROR: localmin: out of memory.\n");
+			return;
+		}
+		for (l = l0; l < l1; l++) {
+			if (cols) {
+				for (i = -r; i < n + r; i++)
+					buf[i+r] = El(a,l,h_edge(i, n, wrap));
+			} else {
+				for (i = -r; i < n + r; i++)
+					buf[i+r] = El(a,h_edge(i, n, wrap),l);
+			}
+			herk_line(buf, buf + m, n, r, max, buf + 2*m, buf + 3*m);
+			if (cols) {
+				for (i = 0; i < n; i++)
+					El(out,l,i) = buf[m+i];
+			} else {
+				memcpy(&El(out,0,l), buf + m, n*sizeof(PTYPE));
+			}
+		}
+		free(buf);
+	}
+};
+
+/*
+  Min (max FALSE) or max of the (2r+1)x(2r+1) box around each pixel,
+  done as a pass along the rows and one along the columns. Off the
+  edges the box wraps if h0 tiles, else the edge pixels repeat, which
+  doesn't change a min or max.
+*/
+hfield *h_localmin(hfield *h0, int r, int max)
+{
+	hfield *h1;
+	PTYPE *tmp;
+	int xsize, ysize;
+
+	h_sync(h0);
+
+	if(h0->c) {
+		fprintf(stderr, "ERROR: localmin: matrix is complex.\n");
+		return NULL;
+	}
+	if(r < 0) {
+		fprintf(stderr, "ERROR: localmin: radius must be >= 0.\n");
+		return NULL;
+	}
+	xsize = h0->xsize;
+	ysize = h0->ysize;
+	r = MIN(r, MAX(xsize, ysize));	/* wider covers the whole line anyway */
+	if(!(h1 = h_new(xsize, ysize, FALSE, FALSE))) return NULL;
+	if(!(tmp = h_alloc((size_t)xsize*ysize, FALSE))) {
+		h_delete(h1);
+		return NULL;
+	}
+
+	int wrap = h_tilable(h0, 0);
+	herk_rows hr(h0->a, tmp, xsize, ysize, r, max, wrap, FALSE);
+	h_parfor(hr, ysize, xsize);
+	herk_rows hc(tmp, h1->a, xsize, ysize, r, max, wrap, TRUE);
+	h_parfor(hc, xsize, ysize);
+
+	h_free(tmp);
+	h_dirty(h1);
+	return h1;
+}
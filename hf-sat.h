@@ -0,0 +1,56 @@
+// -*- C++ -*-
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+#ifndef HF_SAT_H__
+#define HF_SAT_H__
+
+#include "hf-hl.h"
+
+/**
+   Summed-area table of an image: s[y*(xsize+1) + x] is the sum of all
+   pixels above and to the left of x, y, in double precision. The sum
+   over any rectangle then takes four lookups.
+*/
+struct hf_sat {
+	D *s;						/* (xsize+1) x (ysize+1) sums */
+	int xsize, ysize;			/* of the image */
+};
+
+#define Sat(t, x, y)	((t).s[(size_t)(y)*((t).xsize+1) + (x)])
+
+/* a table that owns no buffer yet */
+#define SAT_INIT	{ NULL, 0, 0 }
+
+int sat_build(hf_sat *t, const PTYPE *a, int xsize, int ysize);
+int sat_build_sq(hf_sat *t, const PTYPE *a, int xsize, int ysize, D k);
+void sat_free(hf_sat *t);
+D sat_mean(const hf_sat *t, int x0, int y0, int x1, int y1, int wrap);
+
+/* sum of pixels [x0, x1) x [y0, y1), all within the image */
+static inline D sat_sum(const hf_sat *t, int x0, int y0, int x1, int y1)
+{
+	return Sat(*t,x1,y1) - Sat(*t,x0,y1) - Sat(*t,x1,y0) + Sat(*t,x0,y0);
+}
+
+#endif // HF_SAT_H__
@@ -2,50 +2,112 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <float.h>
 #include "hf-hl.h"
 #include "hf-sclxform.h"
+#include "hf-par.h"
 
 static char rcsid[] UNUSED = "$Id: hf-sclxform.cc,v 1.1.2.4 2003/12/31 15:25:18 zvrba Exp $";
 
+struct op1_rows : public hf_rows {
+	PTYPE *a;
+	U xsize;
+	const scalar_op1 &op;
+
+	op1_rows(PTYPE *a_, U x, const scalar_op1 &o) : a(a_), xsize(x), op(o) { }
+	void run(U y0, U y1) {
+		for (U iy = y0; iy < y1; iy++)	/* one span per row */
+			op.apply(&El(a,0,iy), xsize);
+	}
+};
+
 hfield *h_op1(hfield *h1, const scalar_op1 &op)
 {
-	int cflag;
-	U xsize, ysize, ix, iy;
-	D ht3;
+	if(h_defer(h1, op))				/* evaluated later by h_sync */
+		return h1;
+	h_sync(h1);
+	h_own(h1);
 
-	xsize = h1->xsize;
-	ysize = h1->ysize;
-	cflag = h1->c;
+	op1_rows r(h1->a, h1->xsize, op);
+	if (op.parallel())
+		h_parfor(r, h1->ysize, h1->xsize);
+	else
+		r.run(0, h1->ysize);
 
-	for (iy = 0; iy < ysize; iy++) {
-		for (ix = 0; ix < xsize; ix++) {
-			ht3 = op(El(h1->a,ix,iy));
-			El(h1->a,ix,iy) = ht3;
-		}  /* end for ix */
-	}  /* end for iy */
-
-	h_minmax(h1);
+	h_dirty(h1);
 	return h1;
 }
+
+struct op2_rows : public hf_rows {
+	hfield *h1, *h2, *h3;
+	int xo, yo;
+	int tile, copy;
+	const scalar_op2 &op;
+	hf_minmax mm1, mm2, mm3;
+
+	op2_rows(hfield *a, hfield *b, hfield *c, int x, int y, int t, int cp,
+			 const scalar_op2 &o) :
+		h1(a), h2(b), h3(c), xo(x), yo(y), tile(t), copy(cp), op(o) { }
+	void run(U y0, U y1);
+};
+
+void op2_rows::run(U y0, U y1)
+{
+	int xsize1 = h1->xsize, ysize1 = h1->ysize;
+	int xsize2 = h2->xsize, ysize2 = h2->ysize;
+	PTYPE min1, max1, min2, max2, min3, max3;
+	int iy, yy, n;
+
+	min1 = min2 = min3 = FLT_MAX;
+	max1 = max2 = max3 = -FLT_MAX;
+	n = MIN(xsize1, xsize2-xo);		/* pixels before the right edge of Y */
+	for (yy = y0; yy < (int)y1; yy++) {
+		if (h2->pend)
+			h_sync_span(h2, &El2(h2->a,0,yy), xsize2, &min2, &max2);
+		if (copy)			/* copy over entire Y row to new */
+			memcpy(&El2(h3->a,0,yy), &El2(h2->a,0,yy), xsize2*sizeof(PTYPE));
+
+		iy = yy-yo;			/* row of X landing on this row */
+		if (iy < 0) {
+			if (!tile) continue;
+			iy += ysize2;
+		}
+		if (iy < ysize1) {
+			if (h1->pend)
+				h_sync_span(h1, &El1(h1->a,0,iy), xsize1, &min1, &max1);
+			op.apply(&El1(h1->a,0,iy), &El2(h2->a,xo,yy), &El2(h3->a,xo,yy), n);
+			if (tile && n < xsize1)		/* wrapped part of the row */
+				op.apply(&El1(h1->a,n,iy), &El2(h2->a,0,yy), &El2(h3->a,0,yy),
+						 xsize1-n);
+		}
+		h_sync_span(h3, &El2(h3->a,0,yy), xsize2, &min3, &max3);
+	}
+	mm1.merge(min1, max1);
+	mm2.merge(min2, max2);
+	mm3.merge(min3, max3);
+}
 /**
    Combine two HFs with an offset xo,yo of the (smaller?) X into Y. The
-   template argument function takes two double arguments (pixel value from
-   first and second heightfield) and returns double (result).
+   operation is given two spans: pixels from the first and second
+   heightfield, and writes the result into the third. Each row of X maps
+   to at most two contiguous spans in Y (two only when the offset wraps
+   around the right edge of a tilable Y).
+
+   Without offset, ops pending on X and Y are evaluated row by row in the
+   same pass, together with the min/max of all three HFs.
 */
 hfield *h_op2(hfield *h1, hfield *h2, int xo, int yo, const scalar_op2 &op)
 {
 	int cflag;
-	int xsize,ysize;      /* for Im() operator */
 	int xsize1, ysize1;   /* HF X dimensions */
 	int xsize2, ysize2;   /* HF Y dimensions */
 	hfield *h3;
-	int ix, iy;
-	int xx, yy;
 	int tile;               /* whether to do a tiling operation */
-	D ht1,ht2,ht3;      /* temp HF values */
+	int copy;				/* whether Y is copied to the result first */
+	size_t mem;
 
-	xsize = xsize1 = h1->xsize;      /* X hf */
-	xsize = ysize1 = h1->ysize;
+	xsize1 = h1->xsize;      /* X hf */
+	ysize1 = h1->ysize;
 	xsize2 = h2->xsize;      /* Y hf */
 	ysize2 = h2->ysize;
 	if((xsize1 > xsize2) || (ysize1 > ysize2)) {
@@ -62,61 +124,47 @@ hfield *h_op2(hfield *h1, hfield *h2, int xo, int yo, const scalar_op2 &op)
 			fprintf(stderr, "ERROR: h_op2: real & complex matrices of different size.\n");
 			return NULL;
 		}
+	if ((xo < 0) || (yo < 0) || (xo >= xsize2) || (yo >= ysize2)) {
+		fprintf(stderr, "ERROR: h_op2: offset is negative or larger than HF dimension.\n");
+		return NULL;
+	}
 
-	tile = h_tilable(h2,0);          /* TRUE if Y matrix is tilable */
-  
-	if (cflag) {
-		if(!(h3 = h_newc(xsize2,ysize2))) return NULL;
+	if (xo || yo || h1 == h2) {	/* rows of X and Y don't pair up */
+		h_sync(h1);
+		h_sync(h2);
+		tile = h_tilable(h2,0);          /* TRUE if Y matrix is tilable */
 	} else {
-		if(!(h3 = h_newr(xsize2,ysize2))) return NULL;
+		tile = FALSE;			/* not needed without offset */
+		if (h1->pend) h_own(h1);	/* pending ops are applied in place */
+		if (h2->pend) h_own(h2);
 	}
+  
+	/* every pixel is written below */
+	if(!(h3 = h_new(xsize2,ysize2,cflag,FALSE))) return NULL;
 
-	if ((xo >= xsize2) || (yo >= ysize2)) {
-		fprintf(stderr, "ERROR: h_op2: offset is larger than HF dimension.\n");
-		return NULL;
+	mem = (size_t)xsize2*ysize2*sizeof(PTYPE);
+	copy = (xsize1!=xsize2 || ysize1!=ysize2) || (tile==FALSE && (xo!=0 || yo!=0));
+
+	op2_rows r(h1, h2, h3, xo, yo, tile, copy, op);
+	if (op.parallel())
+		h_parfor(r, ysize2, xsize2);
+	else
+		r.run(0, ysize2);
+
+	if (h1->pend) {
+		h_setminmax(h1, r.mm1.min, r.mm1.max);
+		h_drop(h1);
 	}
-  
-	if ( (xsize1!=xsize2 || ysize1!=ysize2) ||
-		 (tile==FALSE && (xo!=0 || yo!=0))  )   {
-		for (ix=0;ix<xsize2;ix++) {        /* copy over entire Y matrix to new */
-			for (iy=0;iy<ysize2;iy++)  El2(h3->a,ix,iy)=El2(h2->a,ix,iy);
-		}
+	if (h2->pend) {
+		h_setminmax(h2, r.mm2.min, r.mm2.max);
+		h_drop(h2);
 	}
+	h_setminmax(h3, r.mm3.min, r.mm3.max);
 
-	for (iy = 0; iy < ysize1; iy++) {
-		yy = iy+yo;     /* yo = y offset */
-		if (tile && (yy>=ysize2)) yy -= ysize2;
-		for (ix = 0; ix < xsize1; ix++) {
-			xx = ix+xo;                    /* xo = x offset */
-			if (tile && xx>=xsize2) xx -= xsize2;
-			ht1 = El1(h1->a,ix,iy);
-			if (xx<xsize2 && yy<ysize2) {
-				ht2 = El2(h2->a,xx,yy);
-				ht3 = op(ht1, ht2);
-				El2(h3->a,xx,yy) = ht3;
-			} /* end if xx&&yy > 0 */
-
-		}  /* end for ix */
-	}  /* end for iy */
-	if (cflag) {
-		xsize = xsize1;
-		ysize = ysize1;
-		if (h1->c == TRUE) {
-			for (iy = 0; iy < ysize1; iy++) {
-				for (ix = 0; ix < xsize1; ix++) {
-					Im2(h3->a,ix,iy) = Im(h1->a,ix,iy);  /* new */
-				} /* end for x */
-			} /* end for y */
-		} else {
-			for (iy = 0; iy < ysize1; iy++) {
-				for (ix = 0; ix < xsize1; ix++) {
-					Im2(h3->a,ix,iy) = Im(h2->a,ix,iy);  /* new */
-				} /* end for x */
-			} /* end for y */
-		}   /* end else */
+	if (cflag) {		/* sizes are equal here */
+		memcpy(h3->a + (size_t)xsize2*ysize2,
+			   (h1->c ? h1->a : h2->a) + (size_t)xsize1*ysize1, mem);
 	} /* end if cflag */
 	
-	h_minmax(h3);
 	return h3;
 }
-
@@ -2,11 +2,25 @@
 #ifndef HF_SCLXFORM_H__
 #define HF_SCLXFORM_H__
 
+#include <stddef.h>
 #include <math.h>
 #include "hf-hl.h"
+#include "hf-simd.h"
 
 // can't have pure virtual functions in scalar_op because they need to be
 // registered with lua.
+//
+// apply() processes a whole span of pixels in a single call. The default
+// versions fall back to per-pixel operator() (this is what ops defined in
+// lua get); the built-in ops override them with loops the compiler can
+// inline and vectorize, or with explicit SIMD kernels from hf-simd.h.
+//
+// clone() returns a heap copy of the op that h_op1 can keep in the
+// pending chain of a heightfield (see hf-expr.cc). Ops that can't be
+// copied or must run immediately (lua ops) return NULL.
+//
+// parallel() tells whether apply() may be called from several threads at
+// once on different spans.
 struct scalar_op1 {
 	virtual const char *_type() const {
 		return  "scalar_op1";
@@ -14,6 +28,16 @@ struct scalar_op1 {
 	virtual PTYPE operator()(PTYPE) const {
 		return 0;
 	}
+	virtual void apply(PTYPE *p, size_t n) const {
+		for(size_t i = 0; i < n; i++) p[i] = (*this)(p[i]);
+	}
+	virtual scalar_op1 *clone() const {
+		return NULL;
+	}
+	virtual bool parallel() const {
+		return true;
+	}
+	virtual ~scalar_op1() { }
 };
 
 struct scalar_op2 {
@@ -23,20 +47,43 @@ struct scalar_op2 {
 	virtual PTYPE operator()(PTYPE, PTYPE) const {
 		return 0;
 	}
+	virtual void apply(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n) const {
+		for(size_t i = 0; i < n; i++) dst[i] = (*this)(p1[i], p2[i]);
+	}
+	virtual bool parallel() const {
+		return true;
+	}
 };
 
 hfield *h_op1(hfield *h1, const scalar_op1 &op);
 hfield *h_op2(hfield *h1, hfield *h2, int xo, int yo, const scalar_op2 &op);
+
+// deferred evaluation (hf-expr.cc)
+int h_defer(hfield *hf, const scalar_op1 &op);
+void h_sync_span(hfield *hf, PTYPE *p, size_t n, PTYPE *min, PTYPE *max);
 #define STR_(x) #x
 
 // macro form: DECLAREop1_0 means: op1 (single image operation), _0 (0 extra
-// parameters in constructor)
+// parameters in constructor). The body that follows the macro is the
+// per-pixel function eval(); operator() and apply() are derived from it.
 // OP1
 #define DECLAREop1_0(sname) struct op1_##sname : public scalar_op1 {\
   const char *_type() const { return STR_(op1_##sname); }\
-  PTYPE operator()(PTYPE p) const {
+  scalar_op1 *clone() const { return new op1_##sname(*this); }\
+  PTYPE operator()(PTYPE p) const { return eval(p); }\
+  void apply(PTYPE *p, size_t n) const {\
+    for(size_t i = 0; i < n; i++) p[i] = eval(p[i]); }\
+  PTYPE eval(PTYPE p) const {
 #define END } };
 
+// as above, but apply() is given as a SIMD kernel
+#define DECLAREop1v_0(sname, kernel) struct op1_##sname : public scalar_op1 {\
+  const char *_type() const { return STR_(op1_##sname); }\
+  scalar_op1 *clone() const { return new op1_##sname(*this); }\
+  PTYPE operator()(PTYPE p) const { return eval(p); }\
+  void apply(PTYPE *p, size_t n) const { kernel(p, n); }\
+  PTYPE eval(PTYPE p) const {
+
 // TODO: hyperbolic functions
 DECLAREop1_0(sin)	return sin(p); END
 DECLAREop1_0(asin)	if(p < -1) p = -1; if(p > 1) p = 1; return asin(p); END
@@ -44,7 +91,7 @@ DECLAREop1_0(cos)	return cos(p); END
 DECLAREop1_0(acos)	if(p < -1) p = -1; if(p > 1) p = 1; return acos(p); END
 DECLAREop1_0(tan)	return cos(p) == 0 ? 0 : tan(p); END
 DECLAREop1_0(atan)	return atan(p); END
-DECLAREop1_0(abs)	return fabs(p); END
+DECLAREop1v_0(abs, v_abs)	return fabs(p); END
 DECLAREop1_0(inv)	return p == 0 ? 0 : 1 / p; END
 DECLAREop1_0(log)	return p < 0 ? 1 : log(p); END
 
@@ -52,18 +99,29 @@ DECLAREop1_0(log)	return p < 0 ? 1 : log(p); END
   D fac_;\
   op1_##sname(D fac) : fac_(fac) { }\
   const char *_type() const { return STR_(op1_##sname); }\
-  PTYPE operator()(PTYPE p) const {
+  scalar_op1 *clone() const { return new op1_##sname(*this); }\
+  PTYPE operator()(PTYPE p) const { return eval(p); }\
+  void apply(PTYPE *p, size_t n) const {\
+    for(size_t i = 0; i < n; i++) p[i] = eval(p[i]); }\
+  PTYPE eval(PTYPE p) const {
 
 DECLAREop1_1(pow1)	return SGN(p)*pow(fabs(p), fac_); END
 DECLAREop1_1(disc)	return (int)((p*fac_-0.000001)/fac_); END
 DECLAREop1_1(mod)	return p-SGN(p)*fabs(((int)(p/fac_))*fac_); END
 
-#define DECLAREop1_1a(sname, op) DECLAREop1_1(sname) return p op fac_; END
+#define DECLAREop1_1a(sname, op, kernel) struct op1_##sname : public scalar_op1 {\
+  D fac_;\
+  op1_##sname(D fac) : fac_(fac) { }\
+  const char *_type() const { return STR_(op1_##sname); }\
+  scalar_op1 *clone() const { return new op1_##sname(*this); }\
+  PTYPE operator()(PTYPE p) const { return p op fac_; }\
+  void apply(PTYPE *p, size_t n) const { kernel(p, n, fac_); }\
+};
 
-DECLAREop1_1a(add1, +)
-DECLAREop1_1a(sub1, -)
-DECLAREop1_1a(mul1, *)
-DECLAREop1_1a(div1, /)
+DECLAREop1_1a(add1, +, v_add1)
+DECLAREop1_1a(sub1, -, v_sub1)
+DECLAREop1_1a(mul1, *, v_mul1)
+DECLAREop1_1a(div1, /, v_div1)
 
 struct scalar_op1_fc : public scalar_op1 {
 	D fac_, fac2_, sf2_, sf3_;
@@ -77,7 +135,12 @@ struct op1_floor : public scalar_op1_fc {
 	op1_floor(D fac, D fac2, D min, D max) :
 		scalar_op1_fc(fac, fac2, min, max) { }
 	const char *_type() const { return "op1_floor"; }
-	PTYPE operator()(PTYPE p) const {
+	scalar_op1 *clone() const { return new op1_floor(*this); }
+	PTYPE operator()(PTYPE p) const { return eval(p); }
+	void apply(PTYPE *p, size_t n) const {
+		for(size_t i = 0; i < n; i++) p[i] = eval(p[i]);
+	}
+	PTYPE eval(PTYPE p) const {
 		return (p < fac_) ? ((fac2_ > 0) ? fac_ + sf3_*(1-1/(1+p-fac_)) : fac_) : p;
 	}
 };
@@ -86,7 +149,12 @@ struct op1_ceil : public scalar_op1_fc {
 	op1_ceil(D fac, D fac2, D min, D max) :
 		scalar_op1_fc(fac, fac2, min, max) { }
 	const char *_type() const { return "op1_ceil"; }
-	PTYPE operator()(PTYPE p) const {
+	scalar_op1 *clone() const { return new op1_ceil(*this); }
+	PTYPE operator()(PTYPE p) const { return eval(p); }
+	void apply(PTYPE *p, size_t n) const {
+		for(size_t i = 0; i < n; i++) p[i] = eval(p[i]);
+	}
+	PTYPE eval(PTYPE p) const {
 		return (p > fac_) ? ((fac2_ > 0) ? fac_ + sf2_*(1-1/(1+p-fac_)) : fac_) : p;
 	}
 };
@@ -94,17 +162,27 @@ struct op1_ceil : public scalar_op1_fc {
 // OP2
 #define DECLAREop2_0(sname) struct op2_##sname : public scalar_op2 {\
   const char *_type() const { return STR_(op1_##sname); }\
-  PTYPE operator()(PTYPE p1, PTYPE p2) const {
-#define DECLAREop2a_0(sname, op) DECLAREop2_0(sname) return p1 op p2; END
+  PTYPE operator()(PTYPE p1, PTYPE p2) const { return eval(p1, p2); }\
+  void apply(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n) const {\
+    for(size_t i = 0; i < n; i++) dst[i] = eval(p1[i], p2[i]); }\
+  PTYPE eval(PTYPE p1, PTYPE p2) const {
+
+#define DECLAREop2v_0(sname, kernel) struct op2_##sname : public scalar_op2 {\
+  const char *_type() const { return STR_(op1_##sname); }\
+  PTYPE operator()(PTYPE p1, PTYPE p2) const { return eval(p1, p2); }\
+  void apply(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n) const {\
+    kernel(p1, p2, dst, n); }\
+  PTYPE eval(PTYPE p1, PTYPE p2) const {
+#define DECLAREop2a_0(sname, op, kernel) DECLAREop2v_0(sname, kernel) return p1 op p2; END
 
-DECLAREop2a_0(add2, +)
-DECLAREop2a_0(sub2, -)
-DECLAREop2a_0(mul2, *)
-DECLAREop2a_0(div2, /)
+DECLAREop2a_0(add2, +, v_add2)
+DECLAREop2a_0(sub2, -, v_sub2)
+DECLAREop2a_0(mul2, *, v_mul2)
+DECLAREop2a_0(div2, /, v_div2)
 
 DECLAREop2_0(rmag) return hypot(p1, p2); END
 DECLAREop2_0(pow2) return pow(p1 < 0 ? 0 : p1, p2 < 0 ? 0 : p2); END
-DECLAREop2_0(com) return MAX(p1, p2); END
-DECLAREop2_0(comn) return MIN(p1, p2); END
+DECLAREop2v_0(com, v_max2) return MAX(p1, p2); END
+DECLAREop2v_0(comn, v_min2) return MIN(p1, p2); END
 
 #endif
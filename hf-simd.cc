@@ -0,0 +1,411 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+#include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "hf-simd.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+// Each operation is described by a struct with static scalar (s) and, when
+// available, vector (v) members. The loops below are generic in it.
+#if defined(__AVX__)
+#define VOP(name, sop, dop, fop) struct name {\
+  static inline D s(D a, D b) { return sop; }\
+  static inline PTYPE s(PTYPE a, PTYPE b) { return sop; }\
+  static inline __m256d v(__m256d a, __m256d b) { return _mm256_##dop(a, b); }\
+  static inline __m256 v(__m256 a, __m256 b) { return _mm256_##fop(a, b); }\
+};
+#elif defined(__SSE2__)
+#define VOP(name, sop, dop, fop) struct name {\
+  static inline D s(D a, D b) { return sop; }\
+  static inline PTYPE s(PTYPE a, PTYPE b) { return sop; }\
+  static inline __m128d v(__m128d a, __m128d b) { return _mm_##dop(a, b); }\
+  static inline __m128 v(__m128 a, __m128 b) { return _mm_##fop(a, b); }\
+};
+#else
+#define VOP(name, sop, dop, fop) struct name {\
+  static inline D s(D a, D b) { return sop; }\
+  static inline PTYPE s(PTYPE a, PTYPE b) { return sop; }\
+};
+#endif
+
+VOP(add_, a + b, add_pd, add_ps)
+VOP(sub_, a - b, sub_pd, sub_ps)
+VOP(mul_, a * b, mul_pd, mul_ps)
+VOP(div_, a / b, div_pd, div_ps)
+VOP(max_, a > b ? a : b, max_pd, max_ps)	// same semantics as MAX/MIN
+VOP(min_, a < b ? a : b, min_pd, min_ps)	// macros, incl. NaN handling
+
+// float pixel combined with a double constant; computed in double
+template<class Op> static void op1(PTYPE *p, size_t n, D c)
+{
+	size_t i = 0;
+
+#if defined(__AVX__)
+	__m256d vc = _mm256_set1_pd(c);
+	for(; i + 4 <= n; i += 4) {
+		__m256d x = _mm256_cvtps_pd(_mm_loadu_ps(p + i));
+		_mm_storeu_ps(p + i, _mm256_cvtpd_ps(Op::v(x, vc)));
+	}
+#elif defined(__SSE2__)
+	__m128d vc = _mm_set1_pd(c);
+	for(; i + 4 <= n; i += 4) {
+		__m128 x = _mm_loadu_ps(p + i);
+		__m128d lo = Op::v(_mm_cvtps_pd(x), vc);
+		__m128d hi = Op::v(_mm_cvtps_pd(_mm_movehl_ps(x, x)), vc);
+		_mm_storeu_ps(p + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+	}
+#endif
+	for(; i < n; i++) p[i] = Op::s((D)p[i], c);
+}
+
+// two float pixels; computed in float, as op2_* do
+template<class Op> static void op2(
+	const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX__)
+	for(; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, Op::v(_mm256_loadu_ps(p1 + i),
+										_mm256_loadu_ps(p2 + i)));
+#elif defined(__SSE2__)
+	for(; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, Op::v(_mm_loadu_ps(p1 + i),
+									 _mm_loadu_ps(p2 + i)));
+#endif
+	for(; i < n; i++) dst[i] = Op::s(p1[i], p2[i]);
+}
+
+void v_add1(PTYPE *p, size_t n, D c) { op1<add_>(p, n, c); }
+void v_sub1(PTYPE *p, size_t n, D c) { op1<sub_>(p, n, c); }
+void v_mul1(PTYPE *p, size_t n, D c) { op1<mul_>(p, n, c); }
+void v_div1(PTYPE *p, size_t n, D c) { op1<div_>(p, n, c); }
+
+void v_abs(PTYPE *p, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX__)
+	__m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	for(; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(p + i, _mm256_and_ps(_mm256_loadu_ps(p + i), mask));
+#elif defined(__SSE2__)
+	__m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for(; i + 4 <= n; i += 4)
+		_mm_storeu_ps(p + i, _mm_and_ps(_mm_loadu_ps(p + i), mask));
+#endif
+	for(; i < n; i++) p[i] = fabs(p[i]);
+}
+
+#define V2(name, Op) void name(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n)\
+{ op2<Op>(p1, p2, dst, n); }
+
+V2(v_add2, add_)
+V2(v_sub2, sub_)
+V2(v_mul2, mul_)
+V2(v_div2, div_)
+V2(v_max2, max_)
+V2(v_min2, min_)
+
+void v_madd2(const PTYPE *p1, const PTYPE *p2, PTYPE *acc, size_t n, PTYPE c)
+{
+	size_t i = 0;
+
+	// no FMA, so all versions round alike
+#if defined(__AVX__)
+	__m256 vc = _mm256_set1_ps(c);
+	for(; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_add_ps(_mm256_loadu_ps(p1 + i), _mm256_loadu_ps(p2 + i));
+		_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+												_mm256_mul_ps(x, vc)));
+	}
+#elif defined(__SSE2__)
+	__m128 vc = _mm_set1_ps(c);
+	for(; i + 4 <= n; i += 4) {
+		__m128 x = _mm_add_ps(_mm_loadu_ps(p1 + i), _mm_loadu_ps(p2 + i));
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(x, vc)));
+	}
+#endif
+	for(; i < n; i++) acc[i] += (PTYPE)(p1[i] + p2[i]) * c;
+}
+
+// lanes of the min/max accumulators folded into lo, hi
+static inline void fold(const PTYPE *l, const PTYPE *h, int n, PTYPE &lo, PTYPE &hi)
+{
+	for(int j = 0; j < n; j++) {
+		if(l[j] < lo) lo = l[j];
+		if(h[j] > hi) hi = h[j];
+	}
+}
+
+// min_ps/max_ps return the second operand if either is NaN, so keeping
+// the accumulator second skips NaN pixels like the scalar compares do
+void v_minmax(const PTYPE *p, size_t n, PTYPE *min, PTYPE *max)
+{
+	size_t i = 0;
+	PTYPE lo = *min, hi = *max;
+
+#if defined(__AVX__)
+	if(n >= 8) {
+		__m256 vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+		PTYPE l[8], h[8];
+
+		for(; i + 8 <= n; i += 8) {
+			__m256 x = _mm256_loadu_ps(p + i);
+			vlo = _mm256_min_ps(x, vlo);
+			vhi = _mm256_max_ps(x, vhi);
+		}
+		_mm256_storeu_ps(l, vlo); _mm256_storeu_ps(h, vhi);
+		fold(l, h, 8, lo, hi);
+	}
+#elif defined(__SSE2__)
+	if(n >= 4) {
+		__m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+		PTYPE l[4], h[4];
+
+		for(; i + 4 <= n; i += 4) {
+			__m128 x = _mm_loadu_ps(p + i);
+			vlo = _mm_min_ps(x, vlo);
+			vhi = _mm_max_ps(x, vhi);
+		}
+		_mm_storeu_ps(l, vlo); _mm_storeu_ps(h, vhi);
+		fold(l, h, 4, lo, hi);
+	}
+#endif
+	for(; i < n; i++) {
+		if(p[i] < lo) lo = p[i];
+		if(p[i] > hi) hi = p[i];
+	}
+	*min = lo; *max = hi;
+}
+
+size_t v_stats(const PTYPE *p, size_t n, D k, PTYPE *min, PTYPE *max,
+			   D *s1, D *s2)
+{
+	size_t i = 0, nan = 0;
+	PTYPE lo = *min, hi = *max;
+	D a1 = 0, a2 = 0, d;
+
+#if defined(__AVX__)
+	if(n >= 8) {
+		__m256 vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+		__m256d vk = _mm256_set1_pd(k);
+		__m256d v1 = _mm256_setzero_pd(), v2 = _mm256_setzero_pd();
+		PTYPE l[8], h[8];
+		D t1[4], t2[4];
+
+		for(; i + 8 <= n; i += 8) {
+			__m256 x = _mm256_loadu_ps(p + i);
+			nan += 8 - __builtin_popcount(
+				_mm256_movemask_ps(_mm256_cmp_ps(x, x, _CMP_ORD_Q)));
+			vlo = _mm256_min_ps(x, vlo);
+			vhi = _mm256_max_ps(x, vhi);
+
+			// NaN - k is NaN; those lanes are masked to 0
+			__m256d dl = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), vk);
+			__m256d dh = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), vk);
+			dl = _mm256_and_pd(dl, _mm256_cmp_pd(dl, dl, _CMP_ORD_Q));
+			dh = _mm256_and_pd(dh, _mm256_cmp_pd(dh, dh, _CMP_ORD_Q));
+			v1 = _mm256_add_pd(v1, _mm256_add_pd(dl, dh));
+			v2 = _mm256_add_pd(v2, _mm256_add_pd(_mm256_mul_pd(dl, dl),
+												 _mm256_mul_pd(dh, dh)));
+		}
+		_mm256_storeu_ps(l, vlo); _mm256_storeu_ps(h, vhi);
+		fold(l, h, 8, lo, hi);
+		_mm256_storeu_pd(t1, v1); _mm256_storeu_pd(t2, v2);
+		a1 = t1[0] + t1[1] + t1[2] + t1[3];
+		a2 = t2[0] + t2[1] + t2[2] + t2[3];
+	}
+#elif defined(__SSE2__)
+	if(n >= 4) {
+		__m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+		__m128d vk = _mm_set1_pd(k);
+		__m128d v1 = _mm_setzero_pd(), v2 = _mm_setzero_pd();
+		PTYPE l[4], h[4];
+		D t1[2], t2[2];
+
+		for(; i + 4 <= n; i += 4) {
+			__m128 x = _mm_loadu_ps(p + i);
+			nan += 4 - __builtin_popcount(_mm_movemask_ps(_mm_cmpord_ps(x, x)));
+			vlo = _mm_min_ps(x, vlo);
+			vhi = _mm_max_ps(x, vhi);
+
+			// NaN - k is NaN; those lanes are masked to 0
+			__m128d dl = _mm_sub_pd(_mm_cvtps_pd(x), vk);
+			__m128d dh = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), vk);
+			dl = _mm_and_pd(dl, _mm_cmpord_pd(dl, dl));
+			dh = _mm_and_pd(dh, _mm_cmpord_pd(dh, dh));
+			v1 = _mm_add_pd(v1, _mm_add_pd(dl, dh));
+			v2 = _mm_add_pd(v2, _mm_add_pd(_mm_mul_pd(dl, dl), _mm_mul_pd(dh, dh)));
+		}
+		_mm_storeu_ps(l, vlo); _mm_storeu_ps(h, vhi);
+		fold(l, h, 4, lo, hi);
+		_mm_storeu_pd(t1, v1); _mm_storeu_pd(t2, v2);
+		a1 = t1[0] + t1[1];
+		a2 = t2[0] + t2[1];
+	}
+#endif
+	for(; i < n; i++) {
+		if(p[i] != p[i]) {
+			nan++;
+			continue;
+		}
+		if(p[i] < lo) lo = p[i];
+		if(p[i] > hi) hi = p[i];
+		d = p[i] - k;
+		a1 += d;
+		a2 += d*d;
+	}
+	*min = lo; *max = hi;
+	*s1 += a1; *s2 += a2;
+	return nan;
+}
+
+// mean of the 4 neighbours in double, as (l + r + u + d)/4.0 computes it
+#if defined(__AVX__)
+#define LD4(p)	_mm256_cvtps_pd(_mm_loadu_ps(p))
+#define MEAN4(l, r, u, d)	_mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(\
+	_mm256_add_pd(l, r), u), d), _mm256_set1_pd(0.25))
+
+// store where mask, else c; returns the number of changed, non-NaN pixels
+static inline size_t put4(PTYPE *dst, __m256d c, __m256d mean, __m256d mask)
+{
+	__m128 o = _mm256_cvtpd_ps(_mm256_blendv_pd(c, mean, mask));
+	__m128 cf = _mm256_cvtpd_ps(c);
+
+	_mm_storeu_ps(dst, o);
+	return __builtin_popcount(_mm_movemask_ps(
+		_mm_and_ps(_mm_cmpneq_ps(o, cf), _mm_cmpord_ps(cf, cf))));
+}
+#elif defined(__SSE2__)
+#define LD2(p)	_mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*)(p))))
+#define MEAN2(l, r, u, d)	_mm_mul_pd(_mm_add_pd(_mm_add_pd(\
+	_mm_add_pd(l, r), u), d), _mm_set1_pd(0.25))
+
+static inline size_t put2(PTYPE *dst, __m128d c, __m128d mean, __m128d mask)
+{
+	__m128 o = _mm_cvtpd_ps(_mm_or_pd(_mm_and_pd(mask, mean),
+									  _mm_andnot_pd(mask, c)));
+	__m128d od = _mm_cvtps_pd(o);
+
+	_mm_store_sd((double*)dst, _mm_castps_pd(o));
+	return __builtin_popcount(_mm_movemask_pd(
+		_mm_and_pd(_mm_cmpneq_pd(od, c), _mm_cmpord_pd(c, c))));
+}
+#endif
+
+size_t v_slopelim(const PTYPE *c, const PTYPE *u, const PTYPE *d, PTYPE *dst,
+				  size_t n, int curv, D t2)
+{
+	size_t i = 0, k = 0;
+	D x0, l, r, a, b, s;
+	PTYPE o;
+
+#if defined(__AVX__)
+	__m256d vt = _mm256_set1_pd(t2), half = _mm256_set1_pd(0.5);
+	for(; i + 4 <= n; i += 4) {
+		__m256d vc = LD4(c + i), vl = LD4(c + i-1), vr = LD4(c + i+1);
+		__m256d vu = LD4(u + i), vd = LD4(d + i), va, vb;
+
+		if(curv) {
+			va = _mm256_sub_pd(vc, _mm256_mul_pd(_mm256_add_pd(vl, vr), half));
+			vb = _mm256_sub_pd(vc, _mm256_mul_pd(_mm256_add_pd(vu, vd), half));
+		} else {
+			va = _mm256_sub_pd(vc, vl);
+			vb = _mm256_sub_pd(vc, vu);
+		}
+		__m256d vs = _mm256_add_pd(_mm256_mul_pd(va, va), _mm256_mul_pd(vb, vb));
+		k += put4(dst + i, vc, MEAN4(vl, vr, vu, vd), _mm256_cmp_pd(vs, vt, _CMP_GT_OQ));
+	}
+#elif defined(__SSE2__)
+	__m128d vt = _mm_set1_pd(t2), half = _mm_set1_pd(0.5);
+	for(; i + 2 <= n; i += 2) {
+		__m128d vc = LD2(c + i), vl = LD2(c + i-1), vr = LD2(c + i+1);
+		__m128d vu = LD2(u + i), vd = LD2(d + i), va, vb;
+
+		if(curv) {
+			va = _mm_sub_pd(vc, _mm_mul_pd(_mm_add_pd(vl, vr), half));
+			vb = _mm_sub_pd(vc, _mm_mul_pd(_mm_add_pd(vu, vd), half));
+		} else {
+			va = _mm_sub_pd(vc, vl);
+			vb = _mm_sub_pd(vc, vu);
+		}
+		__m128d vs = _mm_add_pd(_mm_mul_pd(va, va), _mm_mul_pd(vb, vb));
+		k += put2(dst + i, vc, MEAN2(vl, vr, vu, vd), _mm_cmpgt_pd(vs, vt));
+	}
+#endif
+	for(; i < n; i++) {
+		x0 = c[i]; l = c[i-1]; r = c[i+1];
+		if(curv) {
+			a = x0 - (l + r)*0.5;
+			b = x0 - ((D)u[i] + d[i])*0.5;
+		} else {
+			a = x0 - l;
+			b = x0 - u[i];
+		}
+		s = a*a + b*b;
+		o = s > t2 ? (PTYPE)((l + r + u[i] + d[i])*0.25) : c[i];
+		if(o != c[i] && c[i] == c[i]) k++;
+		dst[i] = o;
+	}
+	return k;
+}
+
+size_t v_nsmooth(const PTYPE *c, const PTYPE *u, const PTYPE *d, PTYPE *dst,
+				 size_t n, D th1, D th2)
+{
+	size_t i = 0, k = 0;
+	PTYPE o;
+
+#if defined(__AVX__)
+	__m256d v1 = _mm256_set1_pd(th1), v2 = _mm256_set1_pd(th2);
+	for(; i + 4 <= n; i += 4) {
+		__m256d vc = LD4(c + i);
+		__m256d m = _mm256_and_pd(_mm256_cmp_pd(vc, v1, _CMP_GT_OQ),
+								  _mm256_cmp_pd(vc, v2, _CMP_LT_OQ));
+		k += put4(dst + i, vc, MEAN4(LD4(c + i-1), LD4(c + i+1),
+									 LD4(u + i), LD4(d + i)), m);
+	}
+#elif defined(__SSE2__)
+	__m128d v1 = _mm_set1_pd(th1), v2 = _mm_set1_pd(th2);
+	for(; i + 2 <= n; i += 2) {
+		__m128d vc = LD2(c + i);
+		__m128d m = _mm_and_pd(_mm_cmpgt_pd(vc, v1), _mm_cmplt_pd(vc, v2));
+		k += put2(dst + i, vc, MEAN2(LD2(c + i-1), LD2(c + i+1),
+									 LD2(u + i), LD2(d + i)), m);
+	}
+#endif
+	for(; i < n; i++) {
+		o = (c[i] > th1 && c[i] < th2) ?
+			(PTYPE)(((D)c[i-1] + c[i+1] + u[i] + d[i])*0.25) : c[i];
+		if(o != c[i] && c[i] == c[i]) k++;
+		dst[i] = o;
+	}
+	return k;
+}
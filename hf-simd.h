@@ -0,0 +1,76 @@
+// -*- C++ -*-
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+#ifndef HF_SIMD_H__
+#define HF_SIMD_H__
+
+#include <stddef.h>
+#include "hf-hl.h"
+
+/**
+   @file
+   Span kernels for the built-in scalar operations. Each kernel processes n
+   consecutive pixels. AVX or SSE2 versions are selected at compile time
+   (-mavx, -msse2); otherwise a plain C loop is used.
+
+   Operations with a constant are computed in double precision, exactly as
+   the per-pixel operators do, so all versions give identical results.
+*/
+
+/* p[i] = p[i] op c */
+void v_add1(PTYPE *p, size_t n, D c);
+void v_sub1(PTYPE *p, size_t n, D c);
+void v_mul1(PTYPE *p, size_t n, D c);
+void v_div1(PTYPE *p, size_t n, D c);
+void v_abs(PTYPE *p, size_t n);
+
+/* dst[i] = p1[i] op p2[i]; dst may alias p1 or p2 */
+void v_add2(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n);
+void v_sub2(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n);
+void v_mul2(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n);
+void v_div2(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n);
+void v_max2(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n);
+void v_min2(const PTYPE *p1, const PTYPE *p2, PTYPE *dst, size_t n);
+
+/* *min, *max <- extrema of p[0..n) and their old values; NaNs are skipped */
+void v_minmax(const PTYPE *p, size_t n, PTYPE *min, PTYPE *max);
+
+/* as v_minmax, also adding sum(p[i]-k) to *s1 and sum((p[i]-k)^2) to *s2
+   in double precision; returns the number of NaNs, which are left out */
+size_t v_stats(const PTYPE *p, size_t n, D k, PTYPE *min, PTYPE *max,
+			   D *s1, D *s2);
+
+/* acc[i] += c * (p1[i] + p2[i]), in float; for symmetric filter taps */
+void v_madd2(const PTYPE *p1, const PTYPE *p2, PTYPE *acc, size_t n, PTYPE c);
+
+/* one row of a pass of slopelim and nsmooth: c is the row, with c[-1]
+   and c[n] valid, u and d the rows above and below. Where the kernel
+   decides to, the pixel is replaced by the mean of its 4 neighbours,
+   in double precision; returns the number of pixels that changed */
+size_t v_slopelim(const PTYPE *c, const PTYPE *u, const PTYPE *d, PTYPE *dst,
+				  size_t n, int curv, D t2);	/* where slope^2 > t2 */
+size_t v_nsmooth(const PTYPE *c, const PTYPE *u, const PTYPE *d, PTYPE *dst,
+				 size_t n, D th1, D th2);	/* where th1 < c < th2 */
+
+#endif
@@ -0,0 +1,276 @@
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+/*
+ * Tiled evaluation of neighbourhood operators. Going through Elmod or
+ * Elclip costs a division or two compares per neighbour, and a 3x3
+ * window over a wide image walks three rows that are far apart in
+ * memory. h_partiles() instead copies the image block by block, with
+ * an apron of wrapped or clamped neighbours, into a small buffer that
+ * stays in L1/L2 while the kernel runs over it. The edge handling is
+ * done once per block when the apron is filled, so the kernel indexes
+ * the tile with Tl() without any bounds checks.
+ *
+ * For operators that update the image in place, or must visit the
+ * pixels in order, h_pad() makes a copy of the whole image with the
+ * apron around it instead; h_pad_edges() refreshes the apron after
+ * the interior has been changed.
+ *
+ * Iterated operators (smoothing until nothing changes) go through
+ * h_iterate(), which keeps track of which blocks still change and
+ * only recomputes those and their neighbours.
+ *
+ * The image itself stays row-major: El/Im, the FFT, Lua and the file
+ * formats all depend on that, and a 64x64 block plus apron is copied
+ * in a fraction of the time the stencil takes to run over it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hf-hl.h"
+#include "hf-par.h"
+#include "hf-tile.h"
+
+static char rcsid[] UNUSED = "$Id$";
+
+/**
+   Copy block t->x0, t->y0, t->w x t->h of image a and an apron pixels
+   wide border around it to the tile buffer. t->p and t->ld must be set
+   and leave room for the apron.
+*/
+void h_tile_load(hf_tile *t, const PTYPE *a, int xsize, int ysize, int apron, int wrap)
+{
+	const PTYPE *row;
+	PTYPE *q;
+	int x, y;
+
+	for(y = -apron; y < t->h + apron; y++) {
+		row = a + (size_t)h_edge(t->y0 + y, ysize, wrap)*xsize;
+		q = t->p + y*t->ld;
+		for(x = -apron; x < 0; x++)
+			q[x] = row[h_edge(t->x0 + x, xsize, wrap)];
+		memcpy(q, row + t->x0, t->w*sizeof(PTYPE));
+		for(x = t->w; x < t->w + apron; x++)
+			q[x] = row[h_edge(t->x0 + x, xsize, wrap)];
+	}
+}
+
+/* runs the tiles of rows [y0, y1) of tiles with one buffer */
+struct tile_rows : public hf_rows {
+	hf_tiles &body;
+	const PTYPE *a;
+	int xsize, ysize, apron, wrap;
+
+	tile_rows(hf_tiles &b, const PTYPE *p, int x, int y, int ap, int w) :
+		body(b), a(p), xsize(x), ysize(y), apron(ap), wrap(w) { }
+	void run(U y0, U y1) {
+		PTYPE buf[(TILE + 2*TILE_APRON)*(TILE + 2*TILE_APRON)];
+		hf_tile t;
+		U ty;
+
+		t.ld = TILE + 2*apron;
+		t.p = buf + apron*t.ld + apron;
+		for(ty = y0; ty < y1; ty++) {
+			t.y0 = ty*TILE;
+			t.h = MIN(TILE, ysize - t.y0);
+			for(t.x0 = 0; t.x0 < xsize; t.x0 += TILE) {
+				t.w = MIN(TILE, xsize - t.x0);
+				h_tile_load(&t, a, xsize, ysize, apron, wrap);
+				body.run(t);
+			}
+		}
+	}
+};
+
+/**
+   Call body.run() for all TILE x TILE blocks of image a (the last ones
+   may be smaller), each loaded with an apron of the given width (at
+   most TILE_APRON) wrapped around the edges of the image if wrap is
+   TRUE, else clamped to them. Blocks are processed in parallel; a must
+   not be written until h_partiles returns.
+*/
+void h_partiles(hf_tiles &body, const PTYPE *a, int xsize, int ysize, int apron, int wrap)
+{
+	tile_rows tr(body, a, xsize, ysize, apron, wrap);
+
+	h_parfor(tr, (ysize + TILE-1) / TILE, (U)xsize*TILE);
+}
+
+/**
+   Allocate a working copy of the whole image a (xsize x ysize pixels)
+   with an apron pixels wide border, as a single tile. The border is
+   wrapped or clamped like in h_partiles. If a is NULL the buffer is
+   left uninitialized. Returns FALSE if out of memory.
+*/
+int h_pad(hf_tile *t, const PTYPE *a, int xsize, int ysize, int apron, int wrap)
+{
+	PTYPE *buf;
+
+	t->ld = xsize + 2*apron;
+	if(!(buf = h_alloc((size_t)(ysize + 2*apron)*t->ld, FALSE))) {
+		fprintf(stderr, "ERROR: h_pad: out of memory.\n");
+		return FALSE;
+	}
+	t->p = buf + apron*t->ld + apron;
+	t->x0 = t->y0 = 0;
+	t->w = xsize;
+	t->h = ysize;
+	if(a)
+		h_tile_load(t, a, xsize, ysize, apron, wrap);
+	return TRUE;
+}
+
+/**
+   Fill the border of a tile made by h_pad() from its interior.
+*/
+void h_pad_edges(hf_tile *t, int apron, int wrap)
+{
+	PTYPE *q;
+	int x, y;
+
+	for(y = 0; y < t->h; y++) {
+		q = t->p + y*t->ld;
+		for(x = -apron; x < 0; x++)
+			q[x] = q[h_edge(x, t->w, wrap)];
+		for(x = t->w; x < t->w + apron; x++)
+			q[x] = q[h_edge(x, t->w, wrap)];
+	}
+	for(y = -apron; y < 0; y++)
+		memcpy(t->p + y*t->ld - apron, t->p + h_edge(y, t->h, wrap)*t->ld - apron,
+			   t->ld*sizeof(PTYPE));
+	for(y = t->h; y < t->h + apron; y++)
+		memcpy(t->p + y*t->ld - apron, t->p + h_edge(y, t->h, wrap)*t->ld - apron,
+			   t->ld*sizeof(PTYPE));
+}
+
+/**
+   Free a tile made by h_pad().
+*/
+void h_unpad(hf_tile *t)
+{
+	int apron = (t->ld - t->w) / 2;
+
+	h_free(t->p - apron*t->ld - apron);
+	t->p = NULL;
+}
+
+/**
+   Copy the interior of a tile made by h_pad() back to image a.
+*/
+void h_tile_store(const hf_tile *t, PTYPE *a, int xsize)
+{
+	int y;
+
+	for(y = 0; y < t->h; y++)
+		memcpy(a + (size_t)y*xsize, &Tl(*t,0,y), t->w*sizeof(PTYPE));
+}
+
+/* runs the active blocks of rows [y0, y1) of blocks */
+struct sweep_rows : public hf_rows {
+	hf_sweep &body;
+	const hf_tile &src;
+	hf_tile &dst;
+	const unsigned char *act;
+	unsigned char *chg;
+	int nx;
+	U changed;
+
+	sweep_rows(hf_sweep &b, const hf_tile &s, hf_tile &d, const unsigned char *a,
+			   unsigned char *c, int n) :
+		body(b), src(s), dst(d), act(a), chg(c), nx(n), changed(0) { }
+	void run(U y0, U y1) {
+		U n = 0, k, ty;
+		int tx;
+
+		for(ty = y0; ty < y1; ty++) {
+			for(tx = 0; tx < nx; tx++) {
+				int y = ty*TILE, x = tx*TILE;
+
+				if(!act[ty*nx + tx]) {
+					chg[ty*nx + tx] = 0;
+					continue;
+				}
+				k = body.run(src, dst, x, y, MIN(TILE, src.w - x), MIN(TILE, src.h - y));
+				chg[ty*nx + tx] = k > 0;
+				n += k;
+			}
+		}
+		__sync_fetch_and_add(&changed, n);
+	}
+};
+
+/**
+   Run up to passes passes of body, alternately from t0 into t1 and
+   back, stopping early once a pass changes nothing. t0 and t1 are made
+   by h_pad() with an apron of 1 (wrapped or clamped as wrap says);
+   t1 need not be initialized. After the first pass, only the blocks
+   that changed in the previous pass and their neighbours are run: the
+   others would compute what they already hold, so the result is the
+   same as running every block every pass. Returns the number of
+   passes run; the result is in t1 if that is odd, else in t0.
+*/
+int h_iterate(hf_sweep &body, hf_tile *t0, hf_tile *t1, int passes, int wrap)
+{
+	int nx = (t0->w + TILE-1) / TILE, ny = (t0->h + TILE-1) / TILE;
+	unsigned char *act, *chg;
+	hf_tile *t[2] = { t0, t1 };
+	int pass, tx, ty, i, j;
+
+	if(!(act = (unsigned char*)malloc(2 * nx * ny))) {
+		fprintf(stderr, "ERROR: h_iterate: out of memory.\n");
+		return 0;
+	}
+	chg = act + nx*ny;
+	memset(act, 1, nx*ny);
+
+	for(pass = 0; pass < passes; pass++) {
+		sweep_rows sr(body, *t[pass & 1], *t[(pass+1) & 1], act, chg, nx);
+		h_parfor(sr, ny, (U)t0->w*TILE);
+		if(!sr.changed) {
+			pass++;				/* nothing moved: t0 and t1 agree */
+			break;
+		}
+		h_pad_edges(t[(pass+1) & 1], 1, wrap);
+
+		/* next time: blocks that changed and their neighbours */
+		memset(act, 0, nx*ny);
+		for(ty = 0; ty < ny; ty++)
+			for(tx = 0; tx < nx; tx++) {
+				if(!chg[ty*nx + tx])
+					continue;
+				for(j = -1; j <= 1; j++)
+					for(i = -1; i <= 1; i++) {
+						int x = tx + i, y = ty + j;
+
+						if(wrap) {
+							x = h_edge(x, nx, TRUE);
+							y = h_edge(y, ny, TRUE);
+						} else if(x < 0 || x >= nx || y < 0 || y >= ny)
+							continue;
+						act[y*nx + x] = 1;
+					}
+			}
+	}
+	free(act);
+	return pass;
+}
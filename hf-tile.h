@@ -0,0 +1,90 @@
+// -*- C++ -*-
+/*
+  This file is a part of the Raster Alchemy package.
+  Copyright (C) 2004  Zeljko Vrba
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+  You can reach me at the following e-mail addresses:
+
+  zvrba@globalnet.hr
+  mordor@fly.srk.fer.hr
+*/
+#ifndef HF_TILE_H__
+#define HF_TILE_H__
+
+#include "hf-hl.h"
+
+#define TILE		64			/* tile edge in pixels */
+#define TILE_APRON	4			/* widest apron h_partiles supports */
+
+/**
+   A block of at most TILE x TILE pixels of an image (or the whole image,
+   see h_pad), copied into a contiguous buffer together with an apron
+   of neighbouring pixels on every side. Apron pixels outside of the
+   image are wrapped around or clamped to the edge, exactly like Elmod and Elclip would do, so
+   stencil kernels index the tile directly with Tl() for any x, y in
+   [-apron, w+apron) x [-apron, h+apron).
+*/
+struct hf_tile {
+	PTYPE *p;					/* pixel x0,y0 */
+	long ld;					/* distance between rows of p */
+	int x0, y0;					/* position of the block in the image */
+	int w, h;					/* size of the block */
+};
+
+#define Tl(t, x, y)	((t).p[(y)*(t).ld + (x)])
+
+/**
+   Body of a parallel loop over the tiles of an image. run() is called
+   from several threads at once with different tiles; it must only
+   write the pixels of the block it is given.
+*/
+struct hf_tiles {
+	virtual void run(hf_tile &t) = 0;
+	virtual ~hf_tiles() { }
+};
+
+/* row or column i of an image n pixels long, as Elmod or Elclip would pick */
+static inline int h_edge(int i, int n, int wrap)
+{
+	if(i >= 0 && i < n)
+		return i;
+	if(wrap)
+		return ((i % n) + n) % n;
+	return i < 0 ? 0 : n-1;
+}
+
+void h_tile_load(hf_tile *t, const PTYPE *a, int xsize, int ysize, int apron, int wrap);
+void h_partiles(hf_tiles &body, const PTYPE *a, int xsize, int ysize, int apron, int wrap);
+
+int h_pad(hf_tile *t, const PTYPE *a, int xsize, int ysize, int apron, int wrap);
+void h_pad_edges(hf_tile *t, int apron, int wrap);
+void h_unpad(hf_tile *t);
+void h_tile_store(const hf_tile *t, PTYPE *a, int xsize);
+
+/**
+   One pass of an iterated 3x3 operator, as run by h_iterate: run()
+   computes block x0, y0, w x h of dst from src, both made by h_pad,
+   and returns the number of pixels that changed.
+*/
+struct hf_sweep {
+	virtual U run(const hf_tile &src, hf_tile &dst, int x0, int y0, int w, int h) = 0;
+	virtual ~hf_sweep() { }
+};
+
+int h_iterate(hf_sweep &body, hf_tile *t0, hf_tile *t1, int passes, int wrap);
+
+#endif // HF_TILE_H__
@@ -64,6 +64,21 @@ is set to HF_PARAMS.TILE_AUTO.
 ]],
 	gaufac = [[
 Internal variable that was hard-coded to 4.0. Used only in GHILL.
+]],
+	defer = [[
+If non-zero (the default), pointwise operations (ADD1, MUL1, ABS, SIN, ...)
+are not applied immediately. They are remembered and applied all at once,
+in a single pass over the image, when the image is next used by another
+command, displayed or saved. Set to 0 to apply each operation at once.
+]],
+	threads = [[
+Number of threads used by per-pixel operations. 0 (the default) uses one
+thread per processor; 1 disables multithreading. Results don't depend on
+this setting.
+]],
+	pool = [[
+Megabytes of memory from deleted images that are kept for new images of
+the same size, instead of being returned to the system. Default is 256.
 ]]
 }
 
@@ -42,10 +42,12 @@ extern "C" {
 static char rcsid[] UNUSED = "$Id: lua-ext.cc,v 1.1.2.13 2004/09/24 17:18:23 zvrba Exp $";
 
 // just send a message to GUI through a socket
-static void display(RasterDisplayWindow*, const hfield *hf)
+static void display(RasterDisplayWindow*, hfield *hf)
 {
 	extern int GuiSocket[2];
 
+	h_sync(hf);					// GUI thread reads pixels directly
+
 	if(write(GuiSocket[1], &hf, sizeof(hf)) < sizeof(hf)) {
 		fxerror("lua-ext.cc: display: can't send message.\n");
 	}
@@ -56,10 +58,12 @@ static void display(RasterDisplayWindow*, const hfield *hf)
    have 2 channels named "RE" and "IM" (all in uppercase).  Uses 'ZIP'
    compression.
 */
-static bool save(const char *fname, const hfield *hf) try {
+static bool save(const char *fname, hfield *hf) try {
 	using namespace Imf;
 	unsigned int w = hf->xsize, h = hf->ysize;
 
+	h_sync(hf);
+
 	Header header(w, h);
 	FrameBuffer fb;
 
@@ -197,6 +201,9 @@ void register_lua_hf(lua_State *L)
 		.def_readwrite("tile_mode", &HF_PARAMS::tile_mode)
 		.def_readwrite("tile_tol", &HF_PARAMS::tile_tol)
 		.def_readwrite("gaufac", &HF_PARAMS::gaufac)
+		.def_readwrite("defer", &HF_PARAMS::defer)
+		.def_readwrite("threads", &HF_PARAMS::threads)
+		.def_readwrite("pool", &HF_PARAMS::pool)
 		.enum_("TILE")
 		[
 			value("TILE_AUTO", 0),
@@ -210,15 +217,28 @@ void register_lua_hf(lua_State *L)
 		.def("_hkey", &hfield::_hkey)
 		.def_readonly("width", &hfield::xsize)
 		.def_readonly("height", &hfield::ysize)
-		.def_readonly("min", &hfield::min)
-		.def_readonly("max", &hfield::max)
+		.property("min", &hfield::_min)
+		.property("max", &hfield::_max)
 		.def_readonly("cplx", &hfield::c)
+		.def_readonly("rwidth", &hfield::rxsize)
 		.def(const_self == other<hfield>());
 
+	class_<hf_stats>(L, "hf_stats")
+		.def("_type", &hf_stats::_type)
+		.def_readonly("min", &hf_stats::min)
+		.def_readonly("max", &hf_stats::max)
+		.def_readonly("mean", &hf_stats::mean)
+		.def_readonly("var", &hf_stats::var)
+		.def_readonly("n", &hf_stats::n)
+		.def_readonly("nan", &hf_stats::nan);
+
 	function(L, "_hf_delete", h_delete);
+	function(L, "_hf_dup", h_dup);
+	function(L, "_hf_trim", h_trim);
 	function(L, "_hf_minmax", h_minmax);
 	function(L, "_hf_rminmax", r_minmax, pure_out_value(_2) + pure_out_value(_3));
 	function(L, "_hf_iminmax", i_minmax, pure_out_value(_2) + pure_out_value(_3));
+	function(L, "_hf_stats", h_stats);
 	function(L, "_hf_histeq", histeq);
 	function(L, "_hf_hist", h_hist);
 	function(L, "_hf_hshift", h_hshift);
@@ -232,6 +252,11 @@ void register_lua_hf(lua_State *L)
 	function(L, "_hf_tilable", h_tilable);
 	function(L, "_hf_zero", h_zero);
 	function(L, "_hf_const", h_const);
+	function(L, "_hf_boxblur", h_boxblur);
+	function(L, "_hf_localvar", h_localvar);
+	function(L, "_hf_localmin", h_localmin);
+	function(L, "_hf_gaussblur", h_gaussblur);
+	function(L, "_hf_iirblur", h_iirblur);
 	function(L, "_hf_cswap", c_swap);
 	function(L, "_hf_cjoin", c_join);
 	function(L, "_hf_csplit", c_split, pure_out_value(_2) + pure_out_value(_3));
@@ -243,6 +268,7 @@ void register_lua_hf(lua_State *L)
 	function(L, "_hf_gforge", gforge);
 	function(L, "_hf_fill", fillarray);
 	function(L, "_hf_fft", h_fft);
+	function(L, "_hf_rfft", h_rfft);
 	function(L, "_hf_rand", gen_rand);
 	function(L, "_hf_gaussinit", initgauss);
 	function(L, "_hf_gauss", gauss);
@@ -264,7 +290,10 @@ void register_lua_hf(lua_State *L)
 	function(L, "_hf_zedge", h_zedge);
 	function(L, "_hf_nsmooth", h_nsmooth);
 	function(L, "_hf_fillb", h_fillb);
+	function(L, "_hf_floodfill", h_floodfill);
 	function(L, "_hf_find_ua", h_find_ua);
+	function(L, "_hf_erode", h_erode);
+	function(L, "_hf_droplets", h_droplets);
 
 	function(L, "_hf_save", save);
 	function(L, "_hf_load", load);
@@ -49,6 +49,10 @@ struct lua_scalar_op1 : public scalar_op1 {
 		return "lua_scalar_op1";
 	}
 
+	bool parallel() const {		// lua state is not reentrant
+		return false;
+	}
+
 	PTYPE operator()(PTYPE p) const {
 		return luabind::object_cast<PTYPE>(f_(p));
 	}
@@ -63,6 +67,10 @@ struct lua_scalar_op2 : public scalar_op2 {
 	const char *_type() const {
 		return "lua_scalar_op2";
 	}
+
+	bool parallel() const {		// lua state is not reentrant
+		return false;
+	}
 	
 	PTYPE operator()(PTYPE p1, PTYPE p2) const {
 		return luabind::object_cast<PTYPE>(f_(p1, p2));